@@ -0,0 +1,481 @@
+#include "edit_journal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define EJ_MAGIC "iexotjnl"
+#define EJ_VERSION 1
+#define EJ_HEADER 36           // magic, version, base, checksum
+#define EJ_COMPACT_MIN (1 << 20) // journal bytes before a rewrite is worth it
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work; // a descriptor was handed over
+    pthread_cond_t idle; // the thread let go of it
+    int fd;              // to fdatasync, -1 when there is nothing to do
+    int busy;
+    int started;
+} ej = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+        PTHREAD_COND_INITIALIZER, -1, 0, 0};
+
+static void *ej_syncer(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&ej.lock);
+    while (1) {
+        if (ej.fd == -1) {
+            pthread_cond_wait(&ej.work, &ej.lock);
+            continue;
+        }
+        int fd = ej.fd;
+        ej.fd = -1;
+        ej.busy = 1;
+        pthread_mutex_unlock(&ej.lock);
+        // a failure only loses what a crash right now would lose anyway
+        fdatasync(fd);
+        pthread_mutex_lock(&ej.lock);
+        ej.busy = 0;
+        pthread_cond_broadcast(&ej.idle);
+    }
+    return NULL;
+}
+static void ej_sync(int fd) {
+    pthread_mutex_lock(&ej.lock);
+    if (!ej.started) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, ej_syncer, NULL) != 0)
+            abort();
+        pthread_detach(tid);
+        ej.started = 1;
+    }
+    ej.fd = fd;
+    pthread_cond_signal(&ej.work);
+    pthread_mutex_unlock(&ej.lock);
+}
+// waits until the thread no longer uses the descriptor, before it is closed
+static void ej_quiesce() {
+    pthread_mutex_lock(&ej.lock);
+    ej.fd = -1;
+    while (ej.busy)
+        pthread_cond_wait(&ej.idle, &ej.lock);
+    pthread_mutex_unlock(&ej.lock);
+}
+
+static uint32_t ej_hash(const char *p, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; i++)
+        h = (h ^ (unsigned char)p[i]) * 16777619u;
+    return h;
+}
+static size_t ej_put_varint(char *p, unsigned long long v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (char)v;
+    return n;
+}
+static int ej_get_varint(const char **p, const char *end, unsigned *v) {
+    unsigned long long x = 0;
+    for (int shift = 0; *p < end && shift < 35; shift += 7) {
+        unsigned char c = *(*p)++;
+        x |= (unsigned long long)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            if (x > UINT32_MAX)
+                return -1;
+            *v = x;
+            return 0;
+        }
+    }
+    return -1;
+}
+static size_t ej_size(const struct ej_record *r) {
+    return 1 + 3 * 5 + (r->type == EJ_INSERT ? r->n : 0) + 4;
+}
+// encodes r at p, which has room for ej_size(r), and returns its length
+static size_t ej_encode(char *p, const struct ej_record *r) {
+    size_t n = 0;
+    p[n++] = r->type;
+    n += ej_put_varint(p + n, r->row);
+    n += ej_put_varint(p + n, r->col);
+    n += ej_put_varint(p + n, r->n);
+    if (r->type == EJ_INSERT) {
+        memcpy(p + n, r->text, r->n);
+        n += r->n;
+    }
+    uint32_t h = ej_hash(p, n);
+    memcpy(p + n, &h, 4);
+    return n + 4;
+}
+static size_t ej_varint_len(unsigned v) {
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+static size_t ej_encoded_size(const struct ej_record *r) {
+    return 1 + ej_varint_len(r->row) + ej_varint_len(r->col) +
+           ej_varint_len(r->n) + (r->type == EJ_INSERT ? r->n : 0) + 4;
+}
+static int ej_decode(const char **p, const char *end, struct ej_record *r) {
+    const char *start = *p;
+    if (*p >= end)
+        return -1;
+    memset(r, 0, sizeof(*r));
+    r->type = *(*p)++;
+    if ((r->type != EJ_INSERT && r->type != EJ_DELETE) ||
+        ej_get_varint(p, end, &r->row) || ej_get_varint(p, end, &r->col) ||
+        ej_get_varint(p, end, &r->n))
+        return -1;
+    size_t textlen = r->type == EJ_INSERT ? r->n : 0;
+    if ((size_t)(end - *p) < textlen + 4)
+        return -1;
+    uint32_t h;
+    memcpy(&h, *p + textlen, 4);
+    if (h != ej_hash(start, *p - start + textlen))
+        return -1;
+    if (textlen) {
+        r->text = malloc(textlen);
+        if (!r->text)
+            abort();
+        memcpy(r->text, *p, textlen);
+    }
+    *p += textlen + 4;
+    return 0;
+}
+static void ej_header(char *p, const struct ej_base *b) {
+    uint32_t version = EJ_VERSION;
+    memcpy(p, EJ_MAGIC, 8);
+    memcpy(p + 8, &version, 4);
+    memcpy(p + 12, &b->size, 8);
+    memcpy(p + 20, &b->mtime_sec, 8);
+    memcpy(p + 28, &b->mtime_nsec, 8);
+    uint32_t h = ej_hash(p, EJ_HEADER - 4);
+    memcpy(p + EJ_HEADER - 4, &h, 4);
+}
+static void ej_set_base(struct ej_base *b, const struct stat *st) {
+    if (!st) {
+        *b = (struct ej_base){-1, 0, 0};
+        return;
+    }
+    *b = (struct ej_base){st->st_size, st->st_mtim.tv_sec,
+                          st->st_mtim.tv_nsec};
+}
+static int ej_write_all(int fd, const char *p, size_t n) {
+    while (n > 0) {
+        ssize_t w = write(fd, p, n);
+        if (w == -1 && errno == EINTR)
+            continue;
+        if (w == -1)
+            return -1;
+        p += w;
+        n -= w;
+    }
+    return 0;
+}
+static void ej_queue(edit_journal *j, const struct ej_record *r) {
+    if (j->nqueued + ej_size(r) > j->queued_cap) {
+        size_t cap = j->queued_cap ? j->queued_cap : 4096;
+        while (cap < j->nqueued + ej_size(r))
+            cap *= 2;
+        j->queued = realloc(j->queued, cap);
+        if (!j->queued)
+            abort();
+        j->queued_cap = cap;
+    }
+    j->nqueued += ej_encode(j->queued + j->nqueued, r);
+}
+static void ej_free_records(edit_journal *j, unsigned from, unsigned to) {
+    for (unsigned i = from; i < to; i++)
+        free(j->recs[i].text);
+}
+static void ej_close(edit_journal *j) {
+    if (j->fd == -1)
+        return;
+    ej_quiesce();
+    close(j->fd);
+    j->fd = -1;
+}
+/*
+ Writes the merged records into a new journal, syncs it and renames it over
+ the old one, which a crash half way through leaves as it was. This is the
+ one place the editor waits on the disk, and only for compacted records.
+*/
+static int ej_rewrite(edit_journal *j) {
+    size_t cap = EJ_HEADER;
+    for (unsigned i = 0; i < j->nrecs; i++)
+        cap += ej_size(&j->recs[i]);
+    char *buf = malloc(cap);
+    if (!buf)
+        abort();
+    ej_header(buf, &j->base);
+    size_t n = EJ_HEADER;
+    for (unsigned i = 0; i < j->nrecs; i++)
+        n += ej_encode(buf + n, &j->recs[i]);
+
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s-XXXXXX", j->path);
+    int fd = mkstemp(tmp);
+    int err = fd == -1 ? errno : 0;
+    if (!err && (ej_write_all(fd, buf, n) == -1 || fdatasync(fd) == -1))
+        err = errno;
+    if (!err && rename(tmp, j->path) == -1)
+        err = errno;
+    free(buf);
+    if (err) {
+        if (fd != -1) {
+            close(fd);
+            unlink(tmp);
+        }
+        j->err = err;
+        return -1;
+    }
+    ej_close(j);
+    j->fd = fd;
+    j->written = n;
+    j->compact = n;
+    j->nqueued = 0;
+    return 0;
+}
+
+// the journal of target lives next to it, as ".name.iexot-journal"
+void ej_init(edit_journal *j, const char *target, const struct stat *st) {
+    memset(j, 0, sizeof(*j));
+    j->fd = -1;
+    ej_set_base(&j->base, st);
+    const char *slash = strrchr(target, '/');
+    int dirlen = slash ? slash - target + 1 : 0;
+    size_t len = strlen(target) + 16;
+    j->path = malloc(len);
+    if (!j->path)
+        abort();
+    snprintf(j->path, len, "%.*s.%s.iexot-journal", dirlen, target,
+             target + dirlen);
+    j->compact = EJ_HEADER;
+}
+/*
+ Reads the journal a crash left behind into j->recs, for the caller to
+ replay. Returns how many records there are, 0 when there is no journal,
+ or -1 when it is not for the file as it is now; it is then left alone and
+ the buffer goes unjournaled rather than overwrite it. A record cut short
+ by the crash ends the journal and is cut off the file.
+*/
+int ej_load(edit_journal *j) {
+    int fd = open(j->path, O_RDWR);
+    if (fd == -1 && errno == ENOENT)
+        return 0;
+    struct stat st;
+    char *buf = NULL;
+    if (fd == -1 || fstat(fd, &st) == -1 ||
+        !(buf = malloc(st.st_size + 1))) {
+        j->err = errno;
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+    size_t len = 0;
+    while (len < (size_t)st.st_size) {
+        ssize_t n = read(fd, buf + len, st.st_size - len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        len += n;
+    }
+    char header[EJ_HEADER];
+    ej_header(header, &j->base);
+    if (len < EJ_HEADER || memcmp(buf, header, EJ_HEADER)) {
+        free(buf);
+        close(fd);
+        j->err = EEXIST;
+        return -1;
+    }
+    const char *p = buf + EJ_HEADER, *end = buf + len;
+    struct ej_record r;
+    while (ej_decode(&p, end, &r) == 0) {
+        if (j->nrecs == j->cap) {
+            j->cap = j->cap ? j->cap * 2 : 64;
+            j->recs = realloc(j->recs, sizeof(struct ej_record) * j->cap);
+            if (!j->recs)
+                abort();
+        }
+        j->recs[j->nrecs++] = r;
+        j->compact += ej_encoded_size(&r);
+    }
+    j->written = p - buf;
+    free(buf);
+    if (ftruncate(fd, j->written) == -1 ||
+        lseek(fd, j->written, SEEK_SET) == -1) {
+        close(fd);
+        ej_free_records(j, 0, j->nrecs);
+        j->nrecs = 0;
+        j->err = errno;
+        return -1;
+    }
+    j->fd = fd;
+    j->sealed = j->nrecs;
+    return j->nrecs;
+}
+static struct ej_record *ej_last(edit_journal *j, unsigned row, unsigned col,
+                                 int phantom) {
+    if (!j->path || j->err || j->nrecs == j->sealed || phantom)
+        return NULL;
+    struct ej_record *r = &j->recs[j->nrecs - 1];
+    return r->end_row == row && r->end_col == col ? r : NULL;
+}
+static void ej_append(edit_journal *j, const struct ej_record *r) {
+    if (j->nrecs == j->cap) {
+        j->cap = j->cap ? j->cap * 2 : 64;
+        j->recs = realloc(j->recs, sizeof(struct ej_record) * j->cap);
+        if (!j->recs)
+            abort();
+    }
+    j->recs[j->nrecs++] = *r;
+    j->compact += ej_encoded_size(r);
+}
+// records n bytes of s inserted at row, col; phantom is the line past the end
+void ej_insert(edit_journal *j, unsigned row, unsigned col, int phantom,
+               const char *s, size_t n, unsigned end_row, unsigned end_col) {
+    if (!j->path || j->err)
+        return;
+    struct ej_record r = {EJ_INSERT, phantom, row, col, n, NULL, end_row,
+                          end_col};
+    r.text = malloc(n ? n : 1);
+    if (!r.text)
+        abort();
+    memcpy(r.text, s, n);
+    ej_queue(j, &r);
+    struct ej_record *last = ej_last(j, row, col, phantom);
+    // "\r" then "\n" would replay as a single line break
+    if (last && last->type == EJ_INSERT &&
+        !(n && s[0] == '\n' && last->n && last->text[last->n - 1] == '\r')) {
+        j->compact -= ej_encoded_size(last);
+        last->text = realloc(last->text, last->n + n ? last->n + n : 1);
+        if (!last->text)
+            abort();
+        memcpy(last->text + last->n, s, n);
+        last->n += n;
+        last->end_row = end_row;
+        last->end_col = end_col;
+        j->compact += ej_encoded_size(last);
+        free(r.text);
+        return;
+    }
+    ej_append(j, &r);
+}
+// records one backspace at row, col
+void ej_delete(edit_journal *j, unsigned row, unsigned col, unsigned end_row,
+               unsigned end_col) {
+    if (!j->path || j->err)
+        return;
+    struct ej_record r = {EJ_DELETE, 0, row, col, 1, NULL, end_row, end_col};
+    ej_queue(j, &r);
+    struct ej_record *last = ej_last(j, row, col, 0);
+    if (last) {
+        j->compact -= ej_encoded_size(last);
+        if (last->type == EJ_DELETE) {
+            last->n++;
+        } else if (col > 0 && end_row == row && last->n &&
+                   last->text[last->n - 1] != '\n' &&
+                   last->text[last->n - 1] != '\r') {
+            last->n--; // the backspace takes back the last byte typed
+        } else {
+            j->compact += ej_encoded_size(last);
+            ej_append(j, &r);
+            return;
+        }
+        last->end_row = end_row;
+        last->end_col = end_col;
+        j->compact += ej_encoded_size(last);
+        return;
+    }
+    ej_append(j, &r);
+}
+/*
+ Writes the queued records, creating the journal on first use, and has them
+ synced in the background. When the file has grown to several times what
+ the merged records take, it is rewritten from them instead.
+*/
+int ej_flush(edit_journal *j) {
+    if (!j->path || j->err || !j->nqueued || j->base.size < 0)
+        return j->err ? -1 : 0;
+    if (j->fd == -1 || (j->written > EJ_COMPACT_MIN &&
+                        j->written + j->nqueued > 4 * j->compact)) {
+        return ej_rewrite(j);
+    }
+    if (ej_write_all(j->fd, j->queued, j->nqueued) == -1) {
+        j->err = errno;
+        return -1;
+    }
+    j->written += j->nqueued;
+    j->nqueued = 0;
+    ej_sync(j->fd);
+    return 0;
+}
+// marks where the buffer is saved from; returns the mark for ej_rebase()
+unsigned ej_seal(edit_journal *j) {
+    j->sealed = j->nrecs;
+    return j->nrecs;
+}
+/*
+ The file now holds the buffer as it was at mark: the records before it are
+ dropped, and the rest is kept against the saved file. Without any left
+ the journal file goes away.
+*/
+void ej_rebase(edit_journal *j, unsigned mark, const struct stat *st) {
+    if (!j->path || j->err == EEXIST)
+        return;
+    ej_set_base(&j->base, st);
+    ej_free_records(j, 0, mark);
+    memmove(j->recs, j->recs + mark,
+            sizeof(struct ej_record) * (j->nrecs - mark));
+    j->nrecs -= mark;
+    j->sealed = j->sealed > mark ? j->sealed - mark : 0;
+    j->nqueued = 0;
+    j->err = 0;
+    j->compact = EJ_HEADER;
+    for (unsigned i = 0; i < j->nrecs; i++)
+        j->compact += ej_encoded_size(&j->recs[i]);
+    if (!j->nrecs) {
+        ej_close(j);
+        unlink(j->path);
+        j->written = 0;
+        return;
+    }
+    ej_rewrite(j);
+}
+// forgets the records from the first that did not replay, see ej_load()
+void ej_drop(edit_journal *j, unsigned from) {
+    if (from >= j->nrecs)
+        return;
+    ej_free_records(j, from, j->nrecs);
+    j->nrecs = j->sealed = from;
+    j->compact = EJ_HEADER;
+    for (unsigned i = 0; i < j->nrecs; i++)
+        j->compact += ej_encoded_size(&j->recs[i]);
+    ej_rewrite(j);
+}
+// the buffer is closed on purpose, so its journal is no longer needed
+void ej_discard(edit_journal *j) {
+    if (!j->path)
+        return;
+    // a journal ej_load() did not take is someone else's
+    if (j->fd != -1) {
+        ej_close(j);
+        unlink(j->path);
+    }
+    ej_free_records(j, 0, j->nrecs);
+    free(j->recs);
+    free(j->queued);
+    free(j->path);
+    memset(j, 0, sizeof(*j));
+    j->fd = -1;
+}
@@ -0,0 +1,59 @@
+#ifndef EDIT_JOURNAL_H
+#define EDIT_JOURNAL_H
+#include <stddef.h>
+#include <sys/stat.h>
+
+/*
+ Crash journal of one buffer. Edits are appended as small binary records to
+ a file next to the one being edited, and replayed onto that file when it is
+ opened again after a crash. A record is either text inserted at a row and
+ column or a number of backspaces there: the editor's own operations, so a
+ replay goes through the same code typing did.
+
+ Records reach the disk in batches: ej_flush() writes what queued up and a
+ thread fdatasync()s it, so the editor never waits on the disk. In memory,
+ edits that continue one another (typing a word, then fixing a typo) are
+ merged into one record, and once the file has grown well past what the
+ merged records take it is rewritten from them.
+*/
+enum EJ_RECORD { EJ_INSERT = 'I', EJ_DELETE = 'D' };
+struct ej_record {
+    unsigned char type;
+    int phantom;      // started on the line past the end, which it created
+    unsigned row, col; // where the edit starts
+    unsigned n;       // bytes inserted, or backspaces
+    char *text;       // EJ_INSERT only
+    unsigned end_row, end_col; // cursor after the edit
+};
+// the file the records apply to, as stat() saw it
+struct ej_base {
+    long long size; // -1 while there is no such file yet
+    long long mtime_sec, mtime_nsec;
+};
+typedef struct edit_journal {
+    char *path; // NULL while the buffer has no file name
+    int fd;     // -1 until there is something to write
+    struct ej_base base;
+    struct ej_record *recs;
+    unsigned nrecs, cap;
+    unsigned sealed; // records before this are never merged into
+    char *queued;    // encoded records not written yet
+    size_t nqueued, queued_cap;
+    size_t written; // bytes in the file
+    size_t compact; // bytes the merged records take encoded
+    int err;        // errno of the first failure, after which it stops
+} edit_journal;
+
+void ej_init(edit_journal *j, const char *target, const struct stat *st);
+int ej_load(edit_journal *j);
+void ej_insert(edit_journal *j, unsigned row, unsigned col, int phantom,
+               const char *s, size_t n, unsigned end_row, unsigned end_col);
+void ej_delete(edit_journal *j, unsigned row, unsigned col, unsigned end_row,
+               unsigned end_col);
+int ej_flush(edit_journal *j);
+unsigned ej_seal(edit_journal *j);
+void ej_rebase(edit_journal *j, unsigned mark, const struct stat *st);
+void ej_drop(edit_journal *j, unsigned from);
+void ej_discard(edit_journal *j);
+
+#endif
@@ -0,0 +1,164 @@
+#include "event_loop.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define EV_MAX_FDS 16
+#define EV_MAX_TIMERS 16
+#define EV_MAX_SIGNALS 32
+
+struct ev_handler {
+    ev_fn fn;
+    void *arg;
+};
+static struct {
+    struct {
+        int fd;
+        struct ev_handler h;
+    } fds[EV_MAX_FDS];
+    int nfds;
+    struct {
+        long long at;
+        struct ev_handler h;
+    } timers[EV_MAX_TIMERS];
+    int ntimers;
+    struct ev_handler signals[EV_MAX_SIGNALS];
+    volatile sig_atomic_t raised[EV_MAX_SIGNALS];
+    int pipe[2]; // the signal handler writes a byte here to wake poll()
+} ev = {.pipe = {-1, -1}};
+
+long long ev_now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+// replaces the callback of fd if it is already watched
+void ev_watch(int fd, ev_fn fn, void *arg) {
+    int i = 0;
+    while (i < ev.nfds && ev.fds[i].fd != fd)
+        i++;
+    if (i == EV_MAX_FDS)
+        abort();
+    if (i == ev.nfds)
+        ev.nfds++;
+    ev.fds[i].fd = fd;
+    ev.fds[i].h = (struct ev_handler){fn, arg};
+}
+void ev_unwatch(int fd) {
+    for (int i = 0; i < ev.nfds; i++)
+        if (ev.fds[i].fd == fd) {
+            ev.fds[i] = ev.fds[--ev.nfds];
+            return;
+        }
+}
+static void ev_raise(int signo) {
+    int saved = errno;
+    ev.raised[signo] = 1;
+    if (write(ev.pipe[1], "", 1) == -1) {
+        // the pipe is full, so poll() is going to wake up anyway
+    }
+    errno = saved;
+}
+/*
+ Signals only set a flag and wake the loop; the callback runs from ev_wait()
+ once however many times the signal arrived in between.
+*/
+void ev_signal(int signo, ev_fn fn, void *arg) {
+    if (signo <= 0 || signo >= EV_MAX_SIGNALS)
+        abort();
+    if (ev.pipe[0] == -1) {
+        if (pipe(ev.pipe) == -1)
+            abort();
+        for (int i = 0; i < 2; i++) {
+            fcntl(ev.pipe[i], F_SETFL, O_NONBLOCK);
+            fcntl(ev.pipe[i], F_SETFD, FD_CLOEXEC);
+        }
+    }
+    ev.signals[signo] = (struct ev_handler){fn, arg};
+    struct sigaction sa;
+    sa.sa_handler = ev_raise;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(signo, &sa, NULL);
+}
+// arms a one-shot timer; a timer with the same callback is replaced
+void ev_timer(ev_fn fn, void *arg, long long after_ns) {
+    int i = 0;
+    while (i < ev.ntimers && ev.timers[i].h.fn != fn)
+        i++;
+    if (i == EV_MAX_TIMERS)
+        abort();
+    if (i == ev.ntimers)
+        ev.ntimers++;
+    ev.timers[i].at = ev_now_ns() + after_ns;
+    ev.timers[i].h = (struct ev_handler){fn, arg};
+}
+void ev_timer_cancel(ev_fn fn) {
+    for (int i = 0; i < ev.ntimers; i++)
+        if (ev.timers[i].h.fn == fn) {
+            ev.timers[i] = ev.timers[--ev.ntimers];
+            return;
+        }
+}
+/*
+ Waits at most timeout_ns (forever when negative) for a watched descriptor,
+ a signal or a timer, and runs the callbacks of whatever happened. Returns
+ how many callbacks ran, so 0 means the timeout ran out.
+*/
+int ev_wait(long long timeout_ns) {
+    struct pollfd pfd[EV_MAX_FDS + 1];
+    int n = 0, ran = 0;
+    for (; n < ev.nfds; n++)
+        pfd[n] = (struct pollfd){ev.fds[n].fd, POLLIN, 0};
+    if (ev.pipe[0] != -1)
+        pfd[n++] = (struct pollfd){ev.pipe[0], POLLIN, 0};
+    long long now = ev_now_ns();
+    for (int i = 0; i < ev.ntimers; i++) {
+        long long left = ev.timers[i].at > now ? ev.timers[i].at - now : 0;
+        if (timeout_ns < 0 || left < timeout_ns)
+            timeout_ns = left;
+    }
+    int ms = timeout_ns < 0 ? -1 : (int)((timeout_ns + 999999) / 1000000);
+    if (poll(pfd, n, ms) == -1 && errno != EINTR)
+        return -1;
+
+    if (ev.pipe[0] != -1) {
+        char buf[64];
+        while (read(ev.pipe[0], buf, sizeof(buf)) > 0)
+            ;
+        for (int signo = 1; signo < EV_MAX_SIGNALS; signo++)
+            if (ev.raised[signo] && ev.signals[signo].fn) {
+                ev.raised[signo] = 0;
+                ev.signals[signo].fn(ev.signals[signo].arg);
+                ran++;
+            }
+    }
+    // callbacks may watch or unwatch, so each handler is looked up afresh
+    for (int i = 0; i < n; i++) {
+        if (pfd[i].fd == ev.pipe[0] || !pfd[i].revents)
+            continue;
+        for (int j = 0; j < ev.nfds; j++)
+            if (ev.fds[j].fd == pfd[i].fd) {
+                ev.fds[j].h.fn(ev.fds[j].h.arg);
+                ran++;
+                break;
+            }
+    }
+    now = ev_now_ns();
+    for (int i = 0; i < ev.ntimers;) {
+        if (ev.timers[i].at > now) {
+            i++;
+            continue;
+        }
+        struct ev_handler h = ev.timers[i].h;
+        ev.timers[i] = ev.timers[--ev.ntimers];
+        h.fn(h.arg);
+        ran++;
+        i = 0; // the callback may have re-armed or cancelled timers
+    }
+    return ran;
+}
@@ -0,0 +1,21 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+/*
+ One poll() loop for everything the editor waits on: readable file
+ descriptors (the terminal, background job notifications), signals, which a
+ self-pipe turns into a readable descriptor, and one-shot timers on the
+ monotonic clock. Callbacks run from ev_wait() on the calling thread, so
+ they may touch editor state freely.
+*/
+typedef void (*ev_fn)(void *arg);
+
+void ev_watch(int fd, ev_fn fn, void *arg);
+void ev_unwatch(int fd);
+void ev_signal(int signo, ev_fn fn, void *arg);
+void ev_timer(ev_fn fn, void *arg, long long after_ns);
+void ev_timer_cancel(ev_fn fn);
+long long ev_now_ns();
+int ev_wait(long long timeout_ns);
+
+#endif
@@ -1,9 +1,23 @@
 /*** includes ***/
 #include "iexot.h"
-#include "linked_list.h"
+#include "edit_journal.h"
+#include "event_loop.h"
+#include "keyword_set.h"
+#include "memscan.h"
+#include "regex_engine.h"
+#include "row_arena.h"
+#include "save_worker.h"
+#include "search_pool.h"
+#include "syntax_db.h"
+#include "syntax_worker.h"
+#include "text_store.h"
+#include "view_file.h"
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -11,6 +25,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
@@ -21,9 +36,20 @@
 #define IEXOT_TITLE_TOP_PADDING 3
 
 #define IEXOT_TAB_WIDTH 4
-
-#define HL_HIGHLIGHT_NUMBERS (1 << 0)
-#define HL_HIGHLIGHT_STRINGS (1 << 1)
+#define IEXOT_SEARCH_SLICE_NS 8000000 // search work done between two frames
+#define IEXOT_SEARCH_CHUNK 16384      // rows one search worker takes at once
+#define IEXOT_SEARCH_VIEW_CHUNK (64 * VF_CHECKPOINT_EVERY) // same, view mode
+#define IEXOT_FRAME_NS 16666666   // repaint at most 60 times a second in bursts
+#define IEXOT_LATENCY_NS 50000000 // longest a queued key goes unpainted
+#define IEXOT_INPUT_BUF 4096      // bytes read from the terminal at once
+#define IEXOT_ESC_NS 50000000     // pause that ends a lone ESC key
+#define IEXOT_PASTE_NS 1000000000 // pause that ends an unterminated paste
+#define IEXOT_STATUS_MSG_SECS 5   // how long a status message stays up
+#define IEXOT_RESIZE_NS 20000000      // quiet time that ends a resize storm
+#define IEXOT_RESIZE_MAX_NS 100000000 // longest a storm holds back relayout
+#define IEXOT_SYNTAX_SYNC_ROWS 4096 // rows past the watermark scanned inline
+#define IEXOT_SYNTAX_BATCH 65536    // rows snapshotted for the worker at once
+#define IEXOT_JOURNAL_NS 200000000  // longest an edit waits to be journaled
 
 /*** enums ***/
 enum KEYS {
@@ -37,36 +63,10 @@ enum KEYS {
     HOME_KEY,
     END_KEY,
     DEL_KEY,
+    PASTE_KEY, // a bracketed paste, the text is in config.paste
 };
-enum EDITOR_HIGHLIGHT {
-    HL_NORMAL = 0,
-    HL_NUMBER,
-    HL_MATCH,
-    HL_STRING,
-    HL_COMMENT,
-    HL_KEYWORD,
-    HL_DATATYPE
-};
+enum HL_STATE { HLS_NORMAL = 0, HLS_COMMENT, HLS_STRING };
 
-struct editor_syntax {
-    char *filetype;
-    char **filematch;
-    char **keywords;
-    int flags;
-};
-typedef struct erow {
-    int size;
-    int rsize;
-    char *chars;
-    char *render;
-    unsigned char *hl;
-} erow;
-void erow_free(erow *row) {
-    if (!row)
-        return;
-    free(row->chars);
-    free(row);
-}
 /*** filetypes ***/
 
 char *C_HL_extensions[] = {".c", ".h", ".cpp", NULL};
@@ -78,21 +78,76 @@ char *C_HL_keywords[] = {
     "class",  "case",      "#define", "int|",  "long|",   "double|", "float|",
     "char|",  "unsigned|", "signed|", "void|", "NULL",    NULL};
 
+// used when no definition loaded from IEXOT_SYNTAX_DIR claims the file
 struct editor_syntax HLDB[] = {
-    {"c", C_HL_extensions, C_HL_keywords,
+    {"c", C_HL_extensions, NULL, C_HL_keywords, "//", "/*", "*/", "\"'",
      HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS | HL_KEYWORD | HL_DATATYPE},
 };
 #define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0]))
 
 /*** editor ***/
+struct search_state {
+    char *pattern;     // pattern the match set below belongs to
+    size_t plen;
+    int regex;         // Ctrl-r in the prompt: pattern is a regex
+    rx_prog *prog;     // compiled pattern of a regex search
+    char prompt[64];
+    struct sp_matches matches; // every match found so far, in order
+    unsigned *cands; // rows that matched a shorter pattern, not checked yet
+    unsigned ncands, cands_cap, cand;
+    sp_job *job;       // whole-file scan still running on the worker pool
+    text_store rows;   // snapshot the job scans in edit mode
+    unsigned merged;   // chunks of job already appended to matches
+    int placed;        // cursor was moved to the first match
+    int active;        // matches are highlighted
+    int stale;         // text was edited since the scan, rows are off
+    unsigned current;  // match Ctrl-n last moved to
+};
+#define ATTR_INVERSE 0xff // status bar; other attrs are EDITOR_HIGHLIGHT values
+struct abuf {
+    char *b;
+    size_t len, cap;
+};
+#define ABUF_INIT                                                              \
+    { NULL, 0, 0 }
+struct frame_row {
+    uint64_t hash;
+    char *ch;
+    unsigned char *attr;
+};
+/*
+ What the terminal currently shows, cell by cell, so that a repaint only
+ sends the spans that changed. The text rows come first, then the status
+ bar and the message bar.
+*/
+struct frame {
+    struct frame_row *rows;
+    struct frame_row next; // row being composed
+    unsigned nrows, ncols;
+    unsigned rowoff, coloff; // viewport the text rows were drawn for
+    int valid;               // rows match the screen
+    size_t last_bytes;       // written by the last repaint
+    unsigned long frames, skipped;
+    unsigned long long total_bytes;
+    struct timespec painted; // when the last frame was written
+    struct timespec behind;  // first key applied since then, if lagging
+    int lagging;
+    int due; // the screen changed without a key, e.g. a message expired
+    struct abuf out; // kept between frames so repaints do not allocate
+    struct {
+        char s[12];
+        unsigned char len;
+    } sgr[256]; // escape selecting each attr, built once by frame_fit()
+};
 struct editor_config {
     int cx, cy, rx;
     int saved_cx, saved_cy;
-    int flag_mv_line;
-    int prevx;
+    int prevx; // screen column up and down motion aims for
     char *filename;
     char status_msg[100];
     time_t status_msg_time;
+    int status_sticky; // the message is a prompt and stays until answered
+    long long resize_since; // first SIGWINCH not laid out yet, or 0
     int nmodifications;
     int input_turn;
     unsigned scrnrows;
@@ -100,89 +155,256 @@ struct editor_config {
     unsigned nrows;
     unsigned rowoff;
     unsigned coloff;
-    erow *row;
+    text_store rows;
+    row_arena arena; // chars, spans and tabs of every row
+    char *load_slab;
+    int read_only;
+    view_file view;
     struct termios orig_termios;
     struct editor_syntax *syntax;
+    struct editor_syntax *syntaxes; // loaded by editor_load_syntaxes()
+    unsigned nsyntaxes;
+    unsigned syntax_gen; // bumped when the filetype changes
+    int syntax_clean;    // rows whose hl_out is known, see below
+    sw_job *syntax_job;  // carrying syntax_clean forward in the background
+    unsigned char *hl;   // class of every character of the row being built
+    size_t hl_cap;
+    unsigned row_versions;
 
-    Node *current_search_match;
-    Node *search_list_head;
-    Node *search_list_tail;
+    struct search_state search;
+    struct frame frame;
+    struct {
+        char buf[IEXOT_INPUT_BUF];
+        int len, pos;
+    } input; // bytes read from the terminal but not decoded yet
+    struct {
+        char *buf;
+        size_t len, cap;
+    } paste; // text of the last bracketed paste
+    struct {
+        sv_job *job;         // writing a snapshot, until editor_save_reap()
+        int reported;        // the job is over and its result was shown
+        int nmodifications;  // edits the snapshot holds
+        unsigned journal_mark; // journal records the snapshot holds
+        struct timespec start;
+        struct save_chars {
+            char *chars;
+            int cap;
+        } *deferred; // chars edits dropped while the snapshot may read them
+        unsigned ndeferred, deferred_cap;
+    } save;
+    edit_journal journal;
+    int replaying; // edits come from the journal and are not journaled again
 } config;
 /*** row operations ***/
+erow *editor_row_at(int at) {
+    if (config.read_only)
+        return vf_row(&config.view, at);
+    return ts_row(&config.rows, at);
+}
+// the row only if it exists already: a view row is not loaded for this
+erow *editor_row_if_loaded(int at) {
+    if (config.read_only)
+        return vf_cached(&config.view, at);
+    return ts_row(&config.rows, at);
+}
+int editor_check_read_only() {
+    if (config.read_only)
+        editor_set_status_msg("Read-only view, editing is disabled");
+    return config.read_only;
+}
+// forgets the tab index, to be rebuilt from the row's new chars
+void editor_drop_tabs(erow *row) {
+    if (row->ntabs > 0)
+        ra_free(&config.arena, row->tabs, sizeof(struct row_tab) * row->ntabs);
+    row->tabs = NULL;
+    row->ntabs = -1;
+}
+/*
+ Tabs are the only characters wider than one column, so a row's columns are
+ mapped through the list of its tabs: between two tabs cx and rx move
+ together. The list is found with memchr once per change of the row, and
+ both directions of the mapping are then a binary search.
+*/
+void editor_index_tabs(erow *row) {
+    if (row->ntabs >= 0)
+        return;
+    int n = 0;
+    const char *p = row->chars, *end = row->chars + row->size;
+    while (p < end && (p = memchr(p, '\t', end - p)))
+        n++, p++;
+    row->tabs = n ? ra_alloc(&config.arena, sizeof(struct row_tab) * n, NULL)
+                  : NULL;
+    n = 0;
+    p = row->chars;
+    while (p < end && (p = memchr(p, '\t', end - p))) {
+        int cx = p - row->chars;
+        int rx = n ? row->tabs[n - 1].rx + (cx - row->tabs[n - 1].cx - 1) : cx;
+        row->tabs[n++] = (struct row_tab){cx, rx + IEXOT_TAB_WIDTH -
+                                                  rx % IEXOT_TAB_WIDTH};
+        p++;
+    }
+    row->ntabs = n;
+    if (config.read_only && n)
+        vf_recount(&config.view, row);
+}
 int editor_cx_to_rx(erow *row, int cx) {
-    size_t i;
-    int rx = 0;
-    for (i = 0; i < cx; i++) {
-        if (row->chars[i] == '\t')
-            rx += (IEXOT_TAB_WIDTH - 1) - (rx % IEXOT_TAB_WIDTH);
-        rx++;
+    editor_index_tabs(row);
+    // the last tab before cx
+    int lo = 0, hi = row->ntabs;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (row->tabs[mid].cx < cx)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
-    return rx;
+    if (lo == 0)
+        return cx;
+    struct row_tab *t = &row->tabs[lo - 1];
+    return t->rx + (cx - t->cx - 1);
+}
+// the character at render column rx, a tab for any column it covers
+int editor_rx_to_cx(erow *row, int rx) {
+    editor_index_tabs(row);
+    // the first tab that ends past rx
+    int lo = 0, hi = row->ntabs;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (row->tabs[mid].rx <= rx)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    int cx = lo ? row->tabs[lo - 1].cx + 1 + (rx - row->tabs[lo - 1].rx) : rx;
+    if (lo < row->ntabs && cx > row->tabs[lo].cx)
+        cx = row->tabs[lo].cx;
+    return cx < row->size ? cx : row->size;
 }
 /*** syntax highlighting ***/
+// byte classes, so the highlighter tests a character with one load
+enum BYTE_CLASS { BC_SEPARATOR = 1, BC_DIGIT = 2 };
+unsigned char byte_class[256];
+void editor_init_byte_class() {
+    for (int c = 0; c < 256; c++) {
+        if (isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];{}", c))
+            byte_class[c] |= BC_SEPARATOR;
+        if (isdigit(c))
+            byte_class[c] |= BC_DIGIT;
+    }
+}
 int is_separator(int c) {
-    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];{}", c) != NULL;
+    return byte_class[(unsigned char)c] & BC_SEPARATOR;
 }
-void editor_update_syntax(erow *row) {
-    if (row->size < 1)
-        return;
-    row->hl = realloc(row->hl, row->rsize);
-    if (!row->hl)
-        die("editor_update_syntax: hl realloc");
-    memset(row->hl, HL_NORMAL, row->rsize);
-    if (!config.syntax)
-        return;
+/*
+ Highlights one line starting in `state` (one of HL_STATE) and returns the
+ state the line ends in. With hl == NULL only the state is computed, which is
+ what keeps rows that are not drawn cheap to bring up to date.
+*/
+int editor_highlight(const struct editor_syntax *syntax, const char *s,
+                     int len, unsigned char *hl, int state) {
+    if (hl)
+        memset(hl, HL_NORMAL, len);
+    if (!syntax)
+        return HLS_NORMAL;
+    char *scs = syntax->singleline_comment_start;
+    char *mcs = syntax->multiline_comment_start;
+    char *mce = syntax->multiline_comment_end;
+    int scs_len = syntax->scs_len;
+    int mcs_len = syntax->mcs_len;
+    int mce_len = syntax->mce_len;
+    const unsigned char *lex = syntax->lex;
+    // only a string opened by the first quote character continues a line
+    char long_quote = syntax->quotes ? syntax->quotes[0] : 0;
     int i = 0;
     int prev_sep = 1;
-    bool in_string = false;
-    while (i < row->rsize) {
-        char c = row->render[i];
-        unsigned char prev_hl = (i > 0) ? row->hl[i - 1] : HL_NORMAL;
-        // coloring one-line comments
-        if (!in_string) {
-            char next_chr = row->render[i + 1];
-            if (c == '/' && next_chr == '/') {
-                memset(&row->hl[i], HL_COMMENT, row->rsize - i);
-                return;
+    int in_comment = (state == HLS_COMMENT);
+    char in_string = (state == HLS_STRING) ? long_quote : 0;
+    bool continued = false;
+    while (i < len) {
+        char c = s[i];
+        unsigned char lc = lex[(unsigned char)c];
+        unsigned char prev_hl = (hl && i > 0) ? hl[i - 1] : HL_NORMAL;
+        // coloring block comments, possibly opened on a previous line
+        if (in_comment) {
+            if ((lc & LEX_BLOCK_CLOSE) && len - i >= mce_len &&
+                !strncmp(&s[i], mce, mce_len)) {
+                if (hl)
+                    memset(&hl[i], HL_COMMENT, mce_len);
+                i += mce_len;
+                in_comment = 0;
+                prev_sep = 1;
+                continue;
             }
+            if (hl)
+                hl[i] = HL_COMMENT;
+            i++;
+            continue;
         }
-        // coloring strings and literals
-        if ((config.syntax->flags & HL_HIGHLIGHT_STRINGS) &&
-            (row->hl[i] != HL_MATCH)) {
-            if (c == '\"' || c == '\'') {
-                row->hl[i] = HL_STRING;
-                in_string = !in_string;
+        // coloring strings and literals, a trailing '\\' continues them
+        if (in_string) {
+            if (hl)
+                hl[i] = HL_STRING;
+            if (c == '\\') {
+                continued = (i + 1 == len);
+                if (hl && !continued)
+                    hl[i + 1] = HL_STRING;
+                i += 2;
+                continue;
             }
-            if (in_string)
-                row->hl[i] = HL_STRING;
+            if (c == in_string)
+                in_string = 0;
+            i++;
+            prev_sep = 1;
+            continue;
+        }
+        // coloring one-line comments
+        if ((lc & LEX_LINE_COMMENT) && len - i >= scs_len &&
+            !strncmp(&s[i], scs, scs_len)) {
+            if (hl)
+                memset(&hl[i], HL_COMMENT, len - i);
+            return HLS_NORMAL;
+        }
+        if ((lc & LEX_BLOCK_OPEN) && len - i >= mcs_len &&
+            !strncmp(&s[i], mcs, mcs_len)) {
+            if (hl)
+                memset(&hl[i], HL_COMMENT, mcs_len);
+            i += mcs_len;
+            in_comment = 1;
+            continue;
+        }
+        if (lc & LEX_QUOTE) {
+            if (hl)
+                hl[i] = HL_STRING;
+            in_string = c;
+            i++;
+            continue;
+        }
+        // numbers and keywords never change the state
+        if (!hl) {
+            i++;
+            continue;
         }
         // coloring numbers
-        if (config.syntax->flags & HL_HIGHLIGHT_NUMBERS && !in_string) {
-            if ((isdigit(c) && (prev_hl == HL_NUMBER || prev_sep)) ||
+        if (syntax->flags & HL_HIGHLIGHT_NUMBERS) {
+            if (((byte_class[(unsigned char)c] & BC_DIGIT) &&
+                 (prev_hl == HL_NUMBER || prev_sep)) ||
                 (c == '.' && prev_hl == HL_NUMBER)) {
-                row->hl[i] = HL_NUMBER;
+                hl[i] = HL_NUMBER;
                 i++;
                 prev_sep = 0;
                 continue;
             }
         }
+        // a keyword is a whole word: the span up to the next separator
         if (prev_sep) {
-            char **keywords = config.syntax->keywords;
-            int j;
-            for (j = 0; keywords[j]; j++) {
-                size_t kwlen = strlen(keywords[j]);
-                bool is_datatype = keywords[j][kwlen - 1] == '|';
-                if (is_datatype)
-                    kwlen--;
-                if (!strncmp(&row->render[i], keywords[j], kwlen) &&
-                    is_separator(row->render[i + kwlen])) {
-                    memset(&row->hl[i],
-                           (is_datatype) ? HL_DATATYPE : HL_KEYWORD, kwlen);
-                    i += kwlen;
-                    break;
-                }
-            }
-            if (keywords[j] != NULL) {
+            int end = i;
+            while (end < len && !is_separator(s[end]))
+                end++;
+            int type = kw_lookup(syntax->kw, &s[i], end - i);
+            if (type) {
+                memset(&hl[i], type, end - i);
+                i = end;
                 prev_sep = 0;
                 continue;
             }
@@ -190,29 +412,267 @@ void editor_update_syntax(erow *row) {
         prev_sep = is_separator(c);
         i++;
     }
+    if (in_comment)
+        return HLS_COMMENT;
+    if (in_string && in_string == long_quote && continued)
+        return HLS_STRING;
+    return HLS_NORMAL;
+}
+/*
+ Turns the class of every character into spans, leaving HL_NORMAL out. Most
+ lines have a handful of spans, against one byte per column before.
+*/
+void editor_set_spans(erow *row, const unsigned char *hl) {
+    int n = 0;
+    for (int i = 0; i < row->size; i++)
+        if (hl[i] != HL_NORMAL &&
+            (i == 0 || hl[i] != hl[i - 1] || i % 0x1000000 == 0))
+            n++;
+    if (n != row->nspans || !n) {
+        ra_free(&config.arena, row->spans, sizeof(struct hl_span) * row->nspans);
+        row->spans =
+            n ? ra_alloc(&config.arena, sizeof(struct hl_span) * n, NULL)
+              : NULL;
+        row->nspans = n;
+    }
+    struct hl_span *sp = row->spans - 1;
+    for (int i = 0; i < row->size; i++) {
+        if (hl[i] == HL_NORMAL)
+            continue;
+        // spans are cut every 2^24 characters, the most len holds
+        if (i == 0 || hl[i] != hl[i - 1] || i % 0x1000000 == 0)
+            *++sp = (struct hl_span){i, 0, hl[i]};
+        sp->len++;
+    }
+}
+/*
+ Rows [0, config.syntax_clean) have an up to date hl_out. The watermark only
+ moves forward on demand, scanning states without building hl.
+*/
+int editor_syntax_state_before(int at) {
+    if (at == 0 || config.read_only || !config.syntax)
+        return HLS_NORMAL;
+    if (config.syntax_clean < at) {
+        int state = config.syntax_clean
+                        ? editor_row_at(config.syntax_clean - 1)->hl_out
+                        : HLS_NORMAL;
+        for (; config.syntax_clean < at; config.syntax_clean++) {
+            erow *row = editor_row_at(config.syntax_clean);
+            state = editor_highlight(config.syntax, row->chars, row->size,
+                                     NULL, state);
+            row->hl_out = state;
+        }
+    }
+    return editor_row_at(at - 1)->hl_out;
+}
+/*
+ The state a row is drawn from. Near the watermark the rows in between are
+ scanned here, so visible rows are always highlighted on the spot; further
+ away the worker has not got there yet, and the row above is trusted if it
+ was drawn. Such a row is drawn again once its real state is known.
+*/
+int editor_syntax_state_for_draw(int at) {
+    if (config.read_only || !config.syntax ||
+        at - config.syntax_clean <= IEXOT_SYNTAX_SYNC_ROWS)
+        return editor_syntax_state_before(at);
+    erow *prev = editor_row_at(at - 1);
+    if (!prev->dirty && prev->syntax_gen == config.syntax_gen)
+        return prev->hl_out;
+    return HLS_NORMAL;
+}
+/*
+ Called after row `at` changed: its exit state is recomputed and the change
+ is carried forward only until a row ends in the same state as before. A
+ change that keeps going, like opening a block comment near the top of a
+ big file, is left to the worker past IEXOT_SYNTAX_SYNC_ROWS rows by moving
+ the watermark back.
+*/
+void editor_syntax_changed(int at) {
+    if (config.read_only || !config.syntax || at >= config.syntax_clean)
+        return;
+    int state = at ? editor_row_at(at - 1)->hl_out : HLS_NORMAL;
+    for (int until = at + IEXOT_SYNTAX_SYNC_ROWS; at < config.syntax_clean;
+         at++) {
+        if (at == until) {
+            config.syntax_clean = at;
+            return;
+        }
+        erow *row = editor_row_at(at);
+        state = editor_highlight(config.syntax, row->chars, row->size, NULL,
+                                 state);
+        if (state == row->hl_out)
+            return;
+        row->hl_out = state;
+    }
 }
+int editor_syntax_step(const void *syntax, const char *s, int len,
+                       int state) {
+    return editor_highlight(syntax, s, len, NULL, state);
+}
+struct syntax_snapshot {
+    struct sw_line *lines;
+    char *text;
+    size_t bytes; // of the rows that own their chars
+};
+int editor_syntax_snapshot_size(erow *row, unsigned at, void *arg) {
+    (void)at;
+    struct syntax_snapshot *ss = arg;
+    if (!row->borrowed)
+        ss->bytes += row->size;
+    return 0;
+}
+/*
+ Rows still in the load slab never change in place, so the worker reads
+ them where they are; rows with chars of their own are copied, as any edit
+ may move them.
+*/
+int editor_syntax_snapshot_row(erow *row, unsigned at, void *arg) {
+    struct syntax_snapshot *ss = arg;
+    const char *s = row->chars;
+    if (!row->borrowed) {
+        memcpy(ss->text + ss->bytes, row->chars, row->size);
+        s = ss->text + ss->bytes;
+        ss->bytes += row->size;
+    }
+    *ss->lines++ = (struct sw_line){s, row->size, row->version};
+    return 0;
+}
+void editor_syntax_stop() {
+    if (config.syntax_job)
+        sw_free(config.syntax_job);
+    config.syntax_job = NULL;
+}
+void editor_syntax_notified(void *arg);
+/*
+ Hands the next IEXOT_SYNTAX_BATCH rows past the watermark to the worker,
+ unless it is already busy with them. Called whenever the editor is about
+ to wait, so edits that moved the watermark back are picked up.
+*/
+void editor_syntax_background() {
+    sw_job *job = config.syntax_job;
+    if (job && (unsigned)config.syntax_clean < job->first)
+        editor_syntax_stop();
+    if (config.syntax_job || config.read_only || !config.syntax ||
+        config.syntax_clean >= config.nrows)
+        return;
+    unsigned first = config.syntax_clean;
+    unsigned n = config.nrows - first;
+    if (n > IEXOT_SYNTAX_BATCH)
+        n = IEXOT_SYNTAX_BATCH;
+    struct syntax_snapshot ss = {NULL, NULL, 0};
+    ts_for_range(&config.rows, first, first + n, editor_syntax_snapshot_size,
+                 &ss);
+    struct sw_line *lines = malloc(sizeof(struct sw_line) * n);
+    ss = (struct syntax_snapshot){lines, malloc(ss.bytes ? ss.bytes : 1), 0};
+    if (!lines || !ss.text)
+        die("editor_syntax_background: malloc");
+    ts_for_range(&config.rows, first, first + n, editor_syntax_snapshot_row,
+                 &ss);
+    config.syntax_job =
+        sw_submit(lines, ss.text, first, n,
+                  first ? editor_row_at(first - 1)->hl_out : HLS_NORMAL,
+                  editor_syntax_step, config.syntax);
+    ev_watch(sw_notify_fd(), editor_syntax_notified, NULL);
+}
+/*
+ Takes the states the worker published. A state is only used for the row at
+ the watermark, and only if that row has the version it had in the snapshot
+ and the job started it from the state the row above really ends in; an
+ edit anywhere in between makes the rest of the job stale, and it is redone
+ from the watermark.
+*/
+void editor_syntax_notified(void *arg) {
+    (void)arg;
+    sw_drain_notify();
+    sw_job *job = config.syntax_job;
+    if (!job)
+        return;
+    unsigned done = sw_done(job), was = config.syntax_clean;
+    int stale = was < job->first;
+    unsigned k = stale ? 0 : was - job->first;
+    if (!stale && k < done) {
+        int before = k ? job->states[k - 1] : job->state;
+        stale = before != (was ? editor_row_at(was - 1)->hl_out : HLS_NORMAL);
+    }
+    for (; !stale && k < done; k++) {
+        unsigned at = job->first + k;
+        erow *row = at < config.nrows ? editor_row_at(at) : NULL;
+        if (!row || row->version != job->lines[k].version) {
+            stale = 1;
+            break;
+        }
+        row->hl_out = job->states[k];
+        config.syntax_clean++;
+    }
+    if (stale || k >= job->n) {
+        editor_syntax_stop();
+        editor_syntax_background();
+    }
+    // guessed states on screen can now be checked
+    if (config.syntax_clean > was &&
+        was + IEXOT_SYNTAX_SYNC_ROWS < config.rowoff + config.scrnrows)
+        config.frame.due = 1;
+}
+/*
+ Loaded definitions are tried before the built-in ones, by file name and
+ then by the "#!" line, so a script without an extension is still colored.
+*/
 void editor_select_highlight() {
+    editor_syntax_stop();
     config.syntax = NULL;
-    if (!config.filename)
+    config.syntax_gen++;
+    config.syntax_clean = 0;
+    const char *line = NULL;
+    size_t len = 0;
+    if (config.read_only && config.view.len) {
+        line = config.view.map;
+        const char *nl = memchr(line, '\n', config.view.len);
+        len = nl ? (size_t)(nl - line) : config.view.len;
+    } else if (!config.read_only && config.nrows) {
+        erow *row = editor_row_at(0);
+        line = row->chars;
+        len = row->size;
+    }
+    if (!config.filename && !line)
         return;
-    char *ext = strrchr(config.filename, '.');
-    for (unsigned int j = 0; j < HLDB_ENTRIES; j++) {
-        struct editor_syntax *s = &HLDB[j];
-        unsigned int i = 0;
-        while (s->filematch[i]) {
-            int is_ext = (s->filematch[i][0] == '.');
-            if ((is_ext && ext && !strcmp(ext, s->filematch[i])) ||
-                (!is_ext && strstr(config.filename, s->filematch[i]))) {
-                config.syntax = s;
-                int filerow;
-                for (filerow = 0; filerow < config.nrows; filerow++)
-                    editor_update_syntax(&config.row[filerow]);
-                return;
-            }
-            i++;
+    for (unsigned j = 0; j < config.nsyntaxes + HLDB_ENTRIES; j++) {
+        struct editor_syntax *s = j < config.nsyntaxes
+                                      ? &config.syntaxes[j]
+                                      : &HLDB[j - config.nsyntaxes];
+        if (sdb_matches(s, config.filename, line, len)) {
+            sdb_compile(s);
+            config.syntax = s;
+            editor_syntax_background();
+            return;
         }
     }
 }
+/*
+ Definitions come from $IEXOT_SYNTAX_DIR, or the syntax directory under
+ the XDG config home, compiled once into a cache under the XDG cache home.
+*/
+void editor_load_syntaxes(char *err, size_t errlen) {
+    char dir[PATH_MAX], cache[PATH_MAX];
+    err[0] = '\0';
+    const char *home = getenv("HOME");
+    const char *env = getenv("IEXOT_SYNTAX_DIR");
+    if (env)
+        snprintf(dir, sizeof(dir), "%s", env);
+    else if ((env = getenv("XDG_CONFIG_HOME")) && *env)
+        snprintf(dir, sizeof(dir), "%s/iexot/syntax", env);
+    else if (home)
+        snprintf(dir, sizeof(dir), "%s/.config/iexot/syntax", home);
+    else
+        return;
+    if ((env = getenv("XDG_CACHE_HOME")) && *env)
+        snprintf(cache, sizeof(cache), "%s/iexot/syntax.cache", env);
+    else if (home)
+        snprintf(cache, sizeof(cache), "%s/.cache/iexot/syntax.cache", home);
+    else
+        cache[0] = '\0';
+    config.syntaxes = sdb_load(dir, cache[0] ? cache : NULL,
+                               &config.nsyntaxes, err, errlen);
+}
 int editor_syntax_to_color(int hl) {
     switch (hl) {
     case HL_NUMBER:
@@ -231,40 +691,102 @@ int editor_syntax_to_color(int hl) {
         return 37;
     }
 }
+// rows are only marked here; spans are built lazily on first draw
+void editor_redraw_row(erow *row) { row->dirty = 1; }
+// the text of row changed
 void editor_update_row(erow *row) {
-    size_t tabs = 0;
-    for (size_t i = 0; i < row->size; i++)
-        if (row->chars[i] == '\t')
-            tabs++;
-    free(row->render);
-    size_t space_to_allocate =
-        row->size - tabs + 1 +
-        (IEXOT_TAB_WIDTH * tabs); // extra 1 byte for null-terminator
-    row->render = malloc(space_to_allocate);
-    if (!row->render)
-        editor_destroy();
-    size_t idx = 0;
-    for (size_t j = 0; j < row->size; j++) {
-        if (row->chars[j] == '\t') {
-            size_t t = 0;
-            while (t < IEXOT_TAB_WIDTH) {
-                row->render[idx + t] = ' ';
-                t++;
-            }
-            idx += t;
-        } else
-            row->render[idx++] = row->chars[j];
+    row->dirty = 1;
+    editor_drop_tabs(row);
+    row->version = ++config.row_versions;
+}
+// highlights the row into config.hl, then keeps it as spans
+void editor_render_row(erow *row, int at) {
+    int state = editor_syntax_state_for_draw(at);
+    if (!row->dirty && row->syntax_gen == config.syntax_gen &&
+        row->hl_in == state)
+        return;
+    if (config.hl_cap < (size_t)row->size) {
+        config.hl_cap = row->size;
+        free(config.hl);
+        config.hl = malloc(config.hl_cap);
+        if (!config.hl)
+            die("editor_render_row: malloc");
     }
-    row->render[idx] = '\0';
-    row->rsize = idx;
-    editor_update_syntax(row);
+    row->hl_out = editor_highlight(config.syntax, row->chars, row->size,
+                                   config.hl, state);
+    row->hl_in = state;
+    editor_search_highlight(row, at, config.hl);
+    editor_set_spans(row, config.hl);
+    row->dirty = 0;
+    row->syntax_gen = config.syntax_gen;
+    if (config.read_only)
+        vf_recount(&config.view, row); // the spans count against the cache
+}
+/*
+ View-mode rows are materialized only when visited. They are highlighted
+ line by line, without multi-line state, when drawn, which is also when
+ their row number is known for painting search matches.
+*/
+void editor_build_view_row(erow *row) {
+    row->dirty = 1;
+    row->ntabs = -1;
+}
+/*
+ A row whose leaf was copied away from a snapshot shares its chars with it:
+ the capacity goes negative until the row is written, so they are copied
+ first. With no save snapshot left, the row simply has its chars back; a
+ search snapshot is always gone by then, as edits stop the search first.
+*/
+void editor_share_row(erow *row) {
+    if (row->cap > 0)
+        row->cap = -row->cap;
+}
+// frees chars of the arena, or holds them while a save may still read them
+void editor_drop_chars(char *chars, int cap) {
+    if (cap > 0) {
+        ra_free(&config.arena, chars, cap);
+        return;
+    }
+    if (!config.save.job) {
+        ra_free(&config.arena, chars, -cap);
+        return;
+    }
+    if (config.save.ndeferred == config.save.deferred_cap) {
+        config.save.deferred_cap =
+            config.save.deferred_cap ? config.save.deferred_cap * 2 : 64;
+        config.save.deferred =
+            realloc(config.save.deferred,
+                    sizeof(struct save_chars) * config.save.deferred_cap);
+        if (!config.save.deferred)
+            die("editor_drop_chars: realloc");
+    }
+    config.save.deferred[config.save.ndeferred++] =
+        (struct save_chars){chars, -cap};
+}
+/*
+ Makes room for size bytes in row->chars and makes them the row's own to
+ write, copying them out of the load slab or away from a save snapshot if
+ needed. Arena slots are rounded up to a power of two, and long rows get
+ half again their size, so typing into a row rarely moves it.
+*/
+void editor_row_resize(erow *row, size_t size) {
+    if (row->cap < 0 && !config.save.job)
+        row->cap = -row->cap;
+    if (row->cap > 0 && (size_t)row->cap >= size)
+        return;
+    size_t cap;
+    char *chars = ra_alloc(&config.arena, size, &cap);
+    memcpy(chars, row->chars, row->size + 1);
+    if (!row->borrowed)
+        editor_drop_chars(row->chars, row->cap);
+    row->chars = chars;
+    row->cap = cap;
+    row->borrowed = 0;
 }
 void editor_row_insert_char(erow *row, int at, int c) {
     if (at < 0 || at > row->size)
         at = row->size;
-    row->chars = realloc(row->chars, row->size + 2);
-    if (!row->chars)
-        die("editor_row_insert_char: row->char realloc");
+    editor_row_resize(row, row->size + 2);
     memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
     row->size++;
     row->chars[at] = c;
@@ -272,23 +794,31 @@ void editor_row_insert_char(erow *row, int at, int c) {
     editor_update_row(row);
 }
 void editor_free_row(erow *row) {
-    free(row->render);
+    ra_free(&config.arena, row->spans, sizeof(struct hl_span) * row->nspans);
+    editor_drop_tabs(row);
+    if (!row->borrowed)
+        editor_drop_chars(row->chars, row->cap);
+}
+// view rows are read from the mapping into chars of their own
+void editor_free_view_row(erow *row) {
+    ra_free(&config.arena, row->spans, sizeof(struct hl_span) * row->nspans);
+    editor_drop_tabs(row);
     free(row->chars);
-    free(row->hl);
 }
 void editor_del_row(int at) {
     if (at < 0 || at >= config.nrows)
         return;
-    editor_free_row(&config.row[at]);
-    memmove(&config.row[at], &config.row[at + 1],
-            sizeof(erow) * (config.nrows - at - 1));
+    editor_free_row(editor_row_at(at));
+    ts_delete(&config.rows, at);
     config.nrows--;
     config.nmodifications++;
+    if (at < config.syntax_clean) {
+        config.syntax_clean--;
+        editor_syntax_changed(at);
+    }
 }
 void editor_row_append_string(erow *row, const char *s, size_t len) {
-    row->chars = realloc(row->chars, row->size + len + 1);
-    if (!row->chars)
-        die("editor_row_append_string: row->char realloc");
+    editor_row_resize(row, row->size + len + 1);
     memcpy(&row->chars[row->size], s, len);
     row->size += len;
     row->chars[row->size] = '\0';
@@ -298,7 +828,8 @@ void editor_row_append_string(erow *row, const char *s, size_t len) {
 void editor_row_del_char(erow *row, int at) {
     if (at < 0 || at >= row->size + 1)
         return;
-    memmove(&row->chars[at - 1], &row->chars[at], row->size - at);
+    editor_row_resize(row, row->size + 1);
+    memmove(&row->chars[at - 1], &row->chars[at], row->size - at + 1);
     row->size--;
     config.nmodifications++;
     editor_update_row(row);
@@ -306,50 +837,180 @@ void editor_row_del_char(erow *row, int at) {
 void editor_append_line(int at, const char *s, size_t len) {
     if (at < 0 || at > config.nrows)
         return;
-    config.row = realloc(config.row, sizeof(erow) * (config.nrows + 1));
-    if (!config.row)
-        die("editor_append_line: config.row realloc");
-    memmove(&config.row[at + 1], &config.row[at],
-            sizeof(erow) * (config.nrows - at));
+    erow *row = ts_insert(&config.rows, at);
+    if (!row)
+        die("editor_append_line: ts_insert");
 
-    config.row[at].size = len;
-    config.row[at].chars = malloc(len + 1);
-    memcpy(config.row[at].chars, s, len);
-    config.row[at].chars[len] = '\0';
+    size_t cap;
+    row->size = len;
+    row->chars = ra_alloc(&config.arena, len + 1, &cap);
+    row->cap = cap;
+    memcpy(row->chars, s, len);
+    row->chars[len] = '\0';
 
-    config.row[at].rsize = 0;
-    config.row[at].render = NULL;
-    config.row[at].hl = NULL;
-    editor_update_row(&config.row[at]);
+    editor_update_row(row);
 
     config.nrows++;
     config.nmodifications++;
+    if (at < config.syntax_clean) {
+        config.syntax_clean++;
+        row->hl_out = editor_syntax_state_before(at);
+        editor_syntax_changed(at);
+    }
+}
+/*** edit journal ***/
+void editor_journal_flush(void *arg) {
+    (void)arg;
+    int had = config.journal.err;
+    if (ej_flush(&config.journal) == -1 && !had)
+        editor_set_status_msg("Journal stopped: %s",
+                              strerror(config.journal.err));
+}
+/*
+ Operations call this with where they started and whether they changed
+ anything; the journal learns where the cursor ended up, which is what the
+ next edit must start from to be merged into this one.
+*/
+void editor_journal_insert(int row, int col, int phantom, int mods,
+                           const char *s, size_t len) {
+    if (config.replaying || mods == config.nmodifications)
+        return;
+    size_t queued = config.journal.nqueued;
+    ej_insert(&config.journal, row, col, phantom, s, len, config.cy,
+              config.cx);
+    if (!queued && config.journal.nqueued)
+        ev_timer(editor_journal_flush, NULL, IEXOT_JOURNAL_NS);
+}
+void editor_journal_delete(int row, int col, int mods) {
+    if (config.replaying || mods == config.nmodifications)
+        return;
+    size_t queued = config.journal.nqueued;
+    ej_delete(&config.journal, row, col, config.cy, config.cx);
+    if (!queued && config.journal.nqueued)
+        ev_timer(editor_journal_flush, NULL, IEXOT_JOURNAL_NS);
 }
 /*** editor operations ***/
+// a cursor left outside its row edits at the nearest end of it, and says so
+void editor_clamp_cursor() {
+    int size = config.cy < config.nrows ? editor_row_at(config.cy)->size : 0;
+    if (config.cx > size)
+        config.cx = size;
+    if (config.cx < 0)
+        config.cx = 0;
+}
 void editor_insert_char(int c) {
+    if (editor_check_read_only())
+        return;
+    editor_clamp_cursor();
+    int row0 = config.cy, col0 = config.cx, mods = config.nmodifications;
+    int phantom = config.cy == config.nrows;
+    char ch = c;
+    editor_search_invalidate();
     if (config.cy == config.nrows)
         editor_append_line(config.nrows, "", 0);
-    editor_row_insert_char(&config.row[config.cy], config.cx, c);
+    editor_row_insert_char(editor_row_at(config.cy), config.cx, c);
+    editor_syntax_changed(config.cy);
     config.cx++;
+    editor_journal_insert(row0, col0, phantom, mods, &ch, 1);
 }
 void editor_insert_new_line() {
+    if (editor_check_read_only())
+        return;
+    editor_clamp_cursor();
+    int row0 = config.cy, col0 = config.cx, mods = config.nmodifications;
+    int phantom = config.cy == config.nrows;
+    editor_search_invalidate();
     if (config.cx == 0) {
         editor_append_line(config.cy, "", 0);
     } else {
-        erow *row = &config.row[config.cy];
+        erow *row = editor_row_at(config.cy);
         editor_append_line(config.cy + 1, &row->chars[config.cx],
                            row->size - config.cx);
-        row = &config.row[config.cy];
+        row = editor_row_at(config.cy);
+        editor_row_resize(row, row->size + 1);
         row->size = config.cx;
         row->chars[row->size] = '\0';
         editor_update_row(row);
+        editor_syntax_changed(config.cy);
     }
     config.cy++;
     config.cx = 0;
+    // on the line past the end the break is the row it creates, see replay
+    editor_journal_insert(row0, col0, phantom, mods, "\n", !phantom);
+}
+/*
+ Inserts a block of text at the cursor in one pass: the current row is split
+ once, every line of the block becomes a row directly, and the syntax states
+ of the new rows are found in a single sweep instead of once per key.
+ "\r\n", "\r" and "\n" all end a line.
+*/
+void editor_insert_text(const char *s, size_t len) {
+    if (editor_check_read_only() || !len)
+        return;
+    editor_clamp_cursor();
+    int row0 = config.cy, col0 = config.cx, mods = config.nmodifications;
+    int phantom = config.cy == config.nrows;
+    editor_search_invalidate();
+    if (config.cy == config.nrows)
+        editor_append_line(config.nrows, "", 0);
+    int first = config.cy, clean = config.syntax_clean;
+    if (clean > first)
+        config.syntax_clean = first + 1; // new rows are settled below
+    erow *row = editor_row_at(first);
+    size_t n = 0;
+    while (n < len && s[n] != '\r' && s[n] != '\n')
+        n++;
+    if (n == len) {
+        editor_row_resize(row, row->size + len + 1);
+        memmove(&row->chars[config.cx + len], &row->chars[config.cx],
+                row->size - config.cx + 1);
+        memcpy(&row->chars[config.cx], s, len);
+        row->size += len;
+        config.cx += len;
+        config.nmodifications++;
+        editor_update_row(row);
+    } else {
+        size_t taillen = row->size - config.cx;
+        char *tail = malloc(taillen + 1);
+        if (!tail)
+            die("editor_insert_text: malloc");
+        memcpy(tail, &row->chars[config.cx], taillen);
+        row->size = config.cx;
+        editor_row_append_string(row, s, n);
+        int at = first;
+        const char *p = s, *end = s + len;
+        while (p + n < end) {
+            p += n;
+            p += (p[0] == '\r' && p + 1 < end && p[1] == '\n') ? 2 : 1;
+            n = 0;
+            while (p + n < end && p[n] != '\r' && p[n] != '\n')
+                n++;
+            editor_append_line(++at, p, n);
+        }
+        editor_row_append_string(editor_row_at(at), tail, taillen);
+        free(tail);
+        config.cy = at;
+        config.cx = n;
+    }
+    if (clean > first) {
+        int state = editor_syntax_state_before(first);
+        for (int at = first; config.syntax && at <= config.cy; at++) {
+            row = editor_row_at(at);
+            state = editor_highlight(config.syntax, row->chars, row->size,
+                                     NULL, state);
+            row->hl_out = state;
+        }
+        config.syntax_clean = clean + config.cy - first;
+        editor_syntax_changed(config.cy + 1);
+    }
+    editor_journal_insert(row0, col0, phantom, mods, s, len);
 }
 void editor_jmp_next_word() {
-    size_t sz = config.row[config.cy].size;
-    char *line = config.row[config.cy].chars;
+    erow *row = editor_row_at(config.cy);
+    if (!row)
+        return;
+    size_t sz = row->size;
+    char *line = row->chars;
     int i;
     static int flag = 0;
     static int flag_punct = 0;
@@ -368,33 +1029,32 @@ void editor_jmp_next_word() {
             flag_punct = 0;
         if (!flag_punct && ispunct(line[config.cx + i]) &&
             line[config.cx + i] != '_') {
-            for (size_t j = 0; j < i; j++)
-                editor_move_cursor(ARROW_RIGHT);
+            editor_step_cursor(i);
             flag_punct = 1;
             flag = 1;
             return;
         }
         if (flag && isalpha(line[i + config.cx])) {
-            for (size_t j = 0; j < i; j++)
-                editor_move_cursor(ARROW_RIGHT);
+            editor_step_cursor(i);
             flag = 0;
             return;
         }
         if (flag && isdigit(line[config.cx + i])) {
-            for (size_t j = 0; j < i; j++)
-                editor_move_cursor(ARROW_RIGHT);
+            editor_step_cursor(i);
             flag = 0;
             return;
         }
     }
     if (config.cx + i == sz) {
-        for (size_t j = 0; j <= i; j++)
-            editor_move_cursor(ARROW_RIGHT);
+        editor_step_cursor(i + 1);
         flag = 0;
     }
 }
 void editor_jmp_prev_word() {
-    char *line = config.row[config.cy].chars;
+    erow *row = editor_row_at(config.cy);
+    if (!row)
+        return;
+    char *line = row->chars;
     int i;
     static int flag = 0;
     static int flag_punct = 0;
@@ -413,94 +1073,518 @@ void editor_jmp_prev_word() {
             flag_punct = 0;
         if (!flag_punct && ispunct(line[config.cx - i]) &&
             line[config.cx - i] != '_') {
-            for (size_t j = 0; j < i; j++)
-                editor_move_cursor(ARROW_LEFT);
+            editor_step_cursor(-i);
             flag_punct = 1;
             flag = 1;
             return;
         }
         if (flag && isalpha(line[config.cx - i])) {
-            for (size_t j = 0; j < i; j++)
-                editor_move_cursor(ARROW_LEFT);
+            editor_step_cursor(-i);
             flag = 0;
             return;
         }
         if (flag && isdigit(line[config.cx - i])) {
-            for (size_t j = 0; j < i; j++)
-                editor_move_cursor(ARROW_LEFT);
+            editor_step_cursor(-i);
             flag = 0;
             return;
         }
     }
     if (config.cx - i <= 0) {
-        for (size_t j = 0; j <= i; j++)
-            editor_move_cursor(ARROW_LEFT);
+        editor_step_cursor(-(i + 1));
         flag = 0;
     }
 }
 // TODO: refactor it
 void editor_jmp_line_boundaries(int arg) {
-    if (config.row[config.cy].size > 1) {
+    erow *row = editor_row_at(config.cy);
+    if (row && row->size > 1) {
         if (arg == 0) { // 0 means "jump on the beggining of line"
             config.cx = 0;
-            for (; isspace(config.row[config.cy].chars[config.cx]); config.cx++)
+            for (; isspace(row->chars[config.cx]); config.cx++)
                 ;
         } else if (arg == 1) // 1 means "jump on the end of line"
-            config.cx = config.row[config.cy].size - 1;
+            config.cx = row->size - 1;
     }
 }
-int editor_chrptr_to_cx(char *p) {
-    int i;
-    for (i = 0; i < config.row[config.cy].size &&
-                p != (config.row[config.cy].chars + i);
-         i++)
-        ;
-    return i;
-}
-// FIXME: many matches on the same line
-// FIXME: something strange with 'r' symbol (try to search 'editor' or 'term')
-
+/*** search ***/
+void editor_search_push(unsigned **rows, unsigned *n, unsigned *cap,
+                        unsigned at) {
+    if (*n == *cap) {
+        *cap = *cap ? *cap * 2 : 64;
+        *rows = realloc(*rows, sizeof(unsigned) * *cap);
+        if (!*rows)
+            die("editor_search_push: realloc");
+    }
+    (*rows)[(*n)++] = at;
+}
+struct row_scan {
+    struct sp_matches *out;
+    unsigned row;
+    size_t col;  // column of the row at offset 0 of the searched buffer
+    size_t plen;
+    size_t end;  // end of the last match, later ones may not overlap it
+};
+int editor_search_row_match(size_t off, void *arg) {
+    struct row_scan *rs = arg;
+    if (rs->out->n && off < rs->end)
+        return 0;
+    sp_push(rs->out, rs->row, rs->col + off, rs->plen);
+    rs->end = off + rs->plen;
+    return 0;
+}
+/*
+ Appends every non-overlapping match in chars, through the matcher rx for a
+ regex search and memscan otherwise. Safe on any thread as long as each one
+ brings its own matcher.
+*/
+void editor_search_row(const char *chars, size_t size, const char *pattern,
+                       size_t plen, rx_matcher *rx, unsigned at,
+                       struct sp_matches *out) {
+    if (rx) {
+        size_t len;
+        long pos = 0;
+        while ((pos = rx_search(rx, chars, size, pos, &len)) != -1) {
+            sp_push(out, at, pos, len);
+            pos += len;
+        }
+        return;
+    }
+    struct row_scan rs = {out, at, 0, plen, 0};
+    memscan_find(chars, size, pattern, plen, editor_search_row_match, &rs);
+}
+// paints the recorded matches of a row over the classes of its characters
+void editor_search_highlight(erow *row, int at, unsigned char *hl) {
+    struct search_state *s = &config.search;
+    if (!s->active || !s->pattern[0])
+        return;
+    struct sp_match *m = s->matches.v + sp_lower_bound(&s->matches, at, 0);
+    for (; m < s->matches.v + s->matches.n && m->row == at; m++)
+        if (m->col < (unsigned)row->size)
+            memset(&hl[m->col], HL_MATCH,
+                   m->len < row->size - m->col ? m->len : row->size - m->col);
+}
+// drops the highlight of every row in the current match set; view rows that
+// are not loaded have none to drop, and loading them would flush the cache
+void editor_search_unmark() {
+    struct search_state *s = &config.search;
+    for (unsigned i = 0; i < s->matches.n; i++) {
+        if (i && s->matches.v[i].row == s->matches.v[i - 1].row)
+            continue;
+        erow *row = editor_row_if_loaded(s->matches.v[i].row);
+        if (row)
+            editor_redraw_row(row);
+    }
+}
+// waits for the workers to let go of the job, and of the rows it scans
+void editor_search_free_job() {
+    struct search_state *s = &config.search;
+    sp_free(s->job);
+    s->job = NULL;
+    if (!config.read_only)
+        ts_free(&s->rows, NULL);
+}
+/*
+ Hides the matches. A scan still running is cancelled, which also waits for
+ the workers to let go of the rows, so it must happen before any edit; the
+ partial match set it leaves behind is dropped.
+*/
+void editor_search_stop() {
+    struct search_state *s = &config.search;
+    if (s->active)
+        editor_search_unmark();
+    s->active = 0;
+    if (s->job) {
+        editor_search_free_job();
+        s->matches.n = s->ncands = s->cand = 0;
+        free(s->pattern);
+        s->pattern = strdup("");
+        s->plen = 0;
+    }
+}
+// called before the text changes: rows and columns in the index go stale
+void editor_search_invalidate() {
+    editor_search_stop();
+    config.search.stale = 1;
+}
+struct scan_rows {
+    sp_job *job;
+    struct sp_chunk *out;
+    rx_matcher *rx;
+};
+int editor_search_scan_row(erow *row, unsigned at, void *arg) {
+    struct scan_rows *sr = arg;
+    editor_search_row(row->chars, row->size, sr->job->pattern, sr->job->plen,
+                      sr->rx, at, &sr->out->m);
+    return at % 1024 == 0 && sp_cancelled(sr->job);
+}
+/*
+ The scan functions run on the search workers. They may only read: the row
+ tree is walked without its finger, and in view mode the mapped file is
+ searched directly between two checkpoints, turning match offsets into rows
+ by counting the newlines in between.
+*/
+void editor_search_scan_rows(sp_job *job, unsigned chunk,
+                             struct sp_chunk *out) {
+    struct scan_rows sr = {job, out, NULL};
+    if (job->prog)
+        sr.rx = rx_matcher_new(job->prog);
+    ts_for_range(job->src, chunk * job->chunk_rows,
+                 (chunk + 1) * job->chunk_rows, editor_search_scan_row, &sr);
+    if (sr.rx)
+        rx_matcher_free(sr.rx);
+}
+struct scan_view {
+    sp_job *job;
+    struct sp_chunk *out;
+    const char *base;
+    size_t size;
+    size_t counted; // offset up to which newlines were counted
+    unsigned row;   // row containing base + counted
+    size_t line;    // offset of that row
+    size_t end;     // end of the last match, or of the last line regex-scanned
+    const char *pattern; // what memscan looks for: the pattern or its prefix
+    size_t plen;
+    rx_matcher *rx;
+};
+// runs the regex over the line at offset `line` of a mapped chunk
+void editor_search_view_line(struct scan_view *sv, size_t line) {
+    const char *nl = memchr(sv->base + line, '\n', sv->size - line);
+    size_t end = nl ? (size_t)(nl - sv->base) : sv->size;
+    sv->end = end + 1;
+    while (end > line && sv->base[end - 1] == '\r')
+        end--;
+    editor_search_row(sv->base + line, end - line, NULL, 0, sv->rx, sv->row,
+                      &sv->out->m);
+}
+int editor_search_scan_match(size_t off, void *arg) {
+    struct scan_view *sv = arg;
+    size_t n = off - sv->counted;
+    unsigned lines = memscan_count_lines(sv->base + sv->counted, n);
+    if (lines) {
+        sv->row += lines;
+        for (sv->line = off; sv->base[sv->line - 1] != '\n'; sv->line--)
+            ;
+    }
+    sv->counted = off;
+    if (sv->rx) {
+        // a prefix hit: the whole line is matched once, later hits skipped
+        if (off >= sv->end)
+            editor_search_view_line(sv, sv->line);
+    } else if (!sv->out->m.n || off >= sv->end) {
+        sp_push(&sv->out->m, sv->row, off - sv->line, sv->plen);
+        sv->end = off + sv->plen;
+    }
+    return sp_cancelled(sv->job);
+}
+/*
+ A literal pattern is searched for in the whole chunk at once. So is the
+ literal prefix of a regex, and only the lines it occurs on are handed to
+ the regex; a regex without one has to look at every line.
+*/
+void editor_search_scan_view(sp_job *job, unsigned chunk,
+                             struct sp_chunk *out) {
+    view_file *vf = job->src;
+    unsigned per = job->chunk_rows / VF_CHECKPOINT_EVERY;
+    size_t off = vf_checkpoint(vf, chunk * per);
+    size_t end = vf_checkpoint(vf, (chunk + 1) * per);
+    struct scan_view sv = {job, out, vf->map + off, end - off, 0,
+                           chunk * job->chunk_rows, 0, 0, job->pattern,
+                           job->plen, NULL};
+    if (job->prog) {
+        sv.rx = rx_matcher_new(job->prog);
+        sv.pattern = rx_prefix(job->prog, &sv.plen);
+    }
+    if (sv.plen) {
+        memscan_find(sv.base, sv.size, sv.pattern, sv.plen,
+                     editor_search_scan_match, &sv);
+    } else {
+        for (size_t line = 0; line < sv.size && !sp_cancelled(job); sv.row++) {
+            editor_search_view_line(&sv, line);
+            line = sv.end;
+        }
+    }
+    if (sv.rx)
+        rx_matcher_free(sv.rx);
+    vf_drop_range(vf, off, end - off);
+}
+// wakes the event loop when a worker finishes a chunk; editor_idle() merges
+void editor_search_notified(void *arg) {
+    (void)arg;
+    sp_drain_notify();
+}
+/*
+ In edit mode the workers walk a snapshot of the rows: looking rows up while
+ a save snapshot shares the tree copies nodes out of it, which would change
+ the live tree under them. Edits stop the search before they change a row.
+*/
+void editor_search_submit() {
+    struct search_state *s = &config.search;
+    unsigned chunk =
+        config.read_only ? IEXOT_SEARCH_VIEW_CHUNK : IEXOT_SEARCH_CHUNK;
+    if (!config.read_only)
+        ts_snapshot(&config.rows, &s->rows);
+    s->job = sp_submit(s->pattern, s->plen, s->prog, config.nrows, chunk,
+                       config.saved_cy / chunk,
+                       config.read_only ? editor_search_scan_view
+                                        : editor_search_scan_rows,
+                       config.read_only ? (void *)&config.view
+                                        : (void *)&s->rows);
+    s->merged = 0;
+    ev_watch(sp_notify_fd(), editor_search_notified, NULL);
+}
+// shows the search mode, and why a regex does not compile, in the prompt
+void editor_search_prompt(const char *err) {
+    struct search_state *s = &config.search;
+    if (err)
+        snprintf(s->prompt, sizeof(s->prompt), "Regex search (%s): %%s", err);
+    else
+        snprintf(s->prompt, sizeof(s->prompt), "%s: %%s",
+                 s->regex ? "Regex search" : "Search");
+}
+/*
+ Starts matching a new pattern. When it contains the previous one and the
+ previous scan is complete, only the rows that matched before (or were still
+ queued) can match, so they become the candidates and are checked here;
+ otherwise the whole file is handed to the worker pool. That shortcut only
+ holds for literal patterns. A regex goes through the compiled-pattern
+ cache, so editing it back and forth in the prompt compiles it once.
+*/
+void editor_search_reset(const char *pattern) {
+    struct search_state *s = &config.search;
+    if (!strcmp(s->pattern, pattern) && !s->stale)
+        return;
+    editor_search_unmark();
+    if (!s->regex && s->pattern[0] && !s->job && !s->stale &&
+        strstr(pattern, s->pattern)) {
+        unsigned *rows = NULL, n = 0, cap = 0;
+        for (unsigned i = 0; i < s->matches.n; i++)
+            if (!n || rows[n - 1] != s->matches.v[i].row)
+                editor_search_push(&rows, &n, &cap, s->matches.v[i].row);
+        for (unsigned i = s->cand; i < s->ncands; i++)
+            editor_search_push(&rows, &n, &cap, s->cands[i]);
+        free(s->cands);
+        s->cands = rows;
+        s->ncands = n;
+        s->cands_cap = cap;
+    } else {
+        if (s->job)
+            editor_search_free_job();
+        s->ncands = 0;
+    }
+    s->cand = 0;
+    s->matches.n = 0;
+    s->current = 0;
+    s->placed = 0;
+    s->stale = 0;
+    s->active = 1;
+    free(s->pattern);
+    s->pattern = strdup(pattern);
+    s->plen = strlen(pattern);
+    rx_release(s->prog);
+    s->prog = NULL;
+    const char *err = NULL;
+    if (s->regex && pattern[0] && !(s->prog = rx_cached(pattern, &err))) {
+        editor_search_prompt(err);
+        return;
+    }
+    editor_search_prompt(NULL);
+    if (pattern[0] && !s->ncands)
+        editor_search_submit();
+}
+int editor_search_pending() {
+    struct search_state *s = &config.search;
+    return s->active && (s->cand < s->ncands || s->job);
+}
+long editor_elapsed_ns(struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000000000L +
+           (now.tv_nsec - since->tv_nsec);
+}
+// appends the chunks finished by the workers to matches, in row order
+void editor_search_merge() {
+    struct search_state *s = &config.search;
+    sp_job *job = s->job;
+    while (s->merged < job->nchunks && sp_chunk_done(job, s->merged)) {
+        struct sp_matches *m = &job->chunks[s->merged++].m;
+        for (unsigned i = 0; i < m->n; i++) {
+            struct sp_match *x = &m->v[i];
+            sp_push(&s->matches, x->row, x->col, x->len);
+            // rows not loaded yet are painted when they are
+            erow *row = !i || x->row != x[-1].row
+                            ? editor_row_if_loaded(x->row)
+                            : NULL;
+            if (row)
+                editor_redraw_row(row);
+        }
+    }
+    if (s->merged == job->nchunks)
+        editor_search_free_job();
+}
+/*
+ Moves the cursor to the first match at or after the row the search started
+ from, wrapping around. With a scan running this only needs the chunks from
+ the cursor up to that match, which the workers take first, so the jump
+ happens long before the rest of the file is done.
+*/
+void editor_search_place() {
+    struct search_state *s = &config.search;
+    unsigned from = config.saved_cy;
+    struct sp_match *at = NULL;
+    sp_job *job = s->job;
+    if (s->placed)
+        return;
+    if (job) {
+        // the last round looks at the first chunk again, before the cursor
+        for (unsigned k = 0; k <= job->nchunks && !at; k++) {
+            unsigned c = (job->first_chunk + k) % job->nchunks;
+            if (!sp_chunk_done(job, c))
+                return;
+            struct sp_matches *m = &job->chunks[c].m;
+            unsigned i = k == 0 ? sp_lower_bound(m, from, 0) : 0;
+            if (i < m->n)
+                at = &m->v[i];
+        }
+        if (!at)
+            return;
+    } else {
+        unsigned i = sp_lower_bound(&s->matches, from, 0);
+        if (i < s->matches.n)
+            at = &s->matches.v[i];
+        else if (editor_search_pending() || !s->matches.n)
+            return;
+        else
+            at = &s->matches.v[0];
+    }
+    config.cy = at->row;
+    config.cx = at->col;
+    s->placed = 1;
+}
+// merges finished chunks and checks candidates for at most budget_ns
+void editor_search_step(long budget_ns) {
+    struct search_state *s = &config.search;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (s->active && s->job)
+        editor_search_merge();
+    for (unsigned n = 1; s->active && s->cand < s->ncands; n++) {
+        unsigned at = s->cands[s->cand++], had = s->matches.n;
+        erow *row = editor_row_at(at);
+        editor_search_row(row->chars, row->size, s->pattern, s->plen, NULL,
+                          at, &s->matches);
+        if (s->matches.n != had)
+            editor_redraw_row(row);
+        if (n % 256 == 0 && editor_elapsed_ns(&start) > budget_ns)
+            break;
+    }
+    if (s->active)
+        editor_search_place();
+}
+// blocks until the search is complete
+void editor_search_finish() {
+    struct search_state *s = &config.search;
+    while (editor_search_pending()) {
+        if (s->cand == s->ncands) {
+            struct pollfd pfd = {sp_notify_fd(), POLLIN, 0};
+            poll(&pfd, 1, -1);
+            sp_drain_notify();
+        }
+        editor_search_step(IEXOT_SEARCH_SLICE_NS);
+    }
+}
+// index of the match under the cursor, or matches.n
+unsigned editor_search_at_cursor() {
+    struct search_state *s = &config.search;
+    struct sp_match *m = &s->matches.v[s->current];
+    if (s->current < s->matches.n && m->row == config.cy &&
+        m->col == config.cx)
+        return s->current;
+    unsigned i = sp_lower_bound(&s->matches, config.cy, config.cx);
+    if (i < s->matches.n && s->matches.v[i].row == config.cy &&
+        s->matches.v[i].col == config.cx)
+        return i;
+    return s->matches.n;
+}
+/*
+ Ctrl-n: moves to the next (dir 1) or previous (dir -1) match, wrapping
+ around, or back onto the current one (dir 0). From a match this is a step
+ in the index; anywhere else the nearest match is found by binary search.
+ After an edit the whole file is searched again first.
+*/
+void editor_search_jump(int dir) {
+    struct search_state *s = &config.search;
+    if (!s->pattern[0])
+        return;
+    if (s->stale) {
+        char *pattern = strdup(s->pattern);
+        editor_search_reset(pattern);
+        free(pattern);
+        s->placed = 1;
+    }
+    editor_search_finish();
+    unsigned n = s->matches.n, i = editor_search_at_cursor();
+    if (!n)
+        return;
+    if (i < n)
+        i = (i + n + dir) % n;
+    else {
+        i = sp_lower_bound(&s->matches, config.cy, config.cx);
+        if (dir < 0)
+            i = (i + n - 1) % n;
+        else
+            i %= n;
+    }
+    s->current = i;
+    config.cy = s->matches.v[i].row;
+    config.cx = s->matches.v[i].col;
+}
 void editor_find_callback(char *pattern, int k) {
-    char *p = NULL;
-    if (k == 'r' || k == '\x1b') {
+    if (k == '\x1b') {
+        editor_search_stop();
         config.cx = config.saved_cx;
         config.cy = config.saved_cy;
         return;
     }
-    config.search_list_head = NULL;
-    config.search_list_tail = NULL;
-    for (size_t i = 0; i < config.nrows; i++) {
-        erow *row = &config.row[i];
-        editor_update_syntax(row);
-        if ((p = strstr(row->chars, pattern))) {
-            Node *match = create_node(i, p, row->hl);
-            push_back(match, &config.search_list_head,
-                      &config.search_list_tail);
-            config.current_search_match =
-                realloc(config.current_search_match, sizeof(Node *));
-            if (!config.current_search_match)
-                die("config.current_search_match realloc returns NULL");
-            config.current_search_match = config.search_list_head;
-            config.cy = config.current_search_match->cy;
-            config.cx = editor_chrptr_to_cx(config.current_search_match->p);
-
-            memset(&row->hl[p - row->chars], HL_MATCH, strlen(pattern));
-        }
+    if (k == CTRL_KEY('r')) {
+        config.search.regex = !config.search.regex;
+        config.search.stale = 1;
     }
-    if (!config.search_list_head) {
+    editor_search_reset(pattern);
+    if (!config.search.placed) {
         config.cx = config.saved_cx;
         config.cy = config.saved_cy;
     }
+    editor_search_step(IEXOT_SEARCH_SLICE_NS);
 }
 void editor_find() {
     config.saved_cx = config.cx;
     config.saved_cy = config.cy;
-    list_free(config.search_list_head, config.search_list_tail);
-    config.search_list_head = NULL;
-    config.search_list_tail = NULL;
-    char *pattern = editor_prompt("Search: %s", editor_find_callback);
-    if (NULL == pattern)
-        return;
+    editor_search_stop();
+    editor_search_reset("");
+    editor_search_prompt(NULL);
+    char *pattern = editor_prompt(config.search.prompt, editor_find_callback);
+    free(pattern);
+}
+// runs background work in short slices, repainting, until a key arrives
+void editor_idle() {
+    struct search_state *s = &config.search;
+    int unpainted = 0;
+    editor_syntax_background();
+    editor_save_reap();
+    while (editor_search_pending() && config.input.pos == config.input.len) {
+        // sleep until a key arrives or a worker finishes a chunk, unless
+        // there are candidates to check here
+        ev_wait(s->cand < s->ncands ? 0 : -1);
+        if (config.input.pos < config.input.len)
+            break;
+        editor_search_step(IEXOT_SEARCH_SLICE_NS);
+        if (editor_elapsed_ns(&config.frame.painted) >= IEXOT_FRAME_NS)
+            editor_clear_scrn();
+        else
+            unpainted = 1;
+    }
+    if (unpainted && !editor_input_pending())
+        editor_clear_scrn();
 }
 char *editor_prompt(char *prompt, void (*callback)(char *p, int k)) {
     size_t bufsize = 128;
@@ -508,14 +1592,17 @@ char *editor_prompt(char *prompt, void (*callback)(char *p, int k)) {
 
     size_t buflen = 0;
     buf[0] = '\0';
+    config.status_sticky = 1;
     while (1) {
         editor_set_status_msg(prompt, buf);
-        editor_clear_scrn();
+        editor_refresh();
+        editor_idle();
         int c = editor_read_key();
         if (c == BACKSPACE) {
             if (buflen != 0)
                 buf[--buflen] = '\0';
         } else if (c == '\x1b') {
+            config.status_sticky = 0;
             editor_set_status_msg("");
             if (callback)
                 callback(buf, c);
@@ -523,6 +1610,7 @@ char *editor_prompt(char *prompt, void (*callback)(char *p, int k)) {
             return NULL;
         } else if (c == '\r') {
             if (buflen != 0) {
+                config.status_sticky = 0;
                 editor_set_status_msg("");
                 if (callback)
                     callback(buf, c);
@@ -535,67 +1623,201 @@ char *editor_prompt(char *prompt, void (*callback)(char *p, int k)) {
             }
             buf[buflen++] = c;
             buf[buflen] = '\0';
+        } else if (c == PASTE_KEY) {
+            // the prompt takes one line, the paste's first
+            for (size_t i = 0; i < config.paste.len; i++) {
+                char p = config.paste.buf[i];
+                if (p == '\r' || p == '\n')
+                    break;
+                if (iscntrl(p))
+                    continue;
+                if (buflen == bufsize - 1) {
+                    bufsize *= 2;
+                    buf = realloc(buf, bufsize);
+                }
+                buf[buflen++] = p;
+                buf[buflen] = '\0';
+            }
         }
         if (callback)
             callback(buf, c);
     }
 }
 void editor_del_char() {
+    if (editor_check_read_only())
+        return;
+    editor_clamp_cursor();
+    editor_search_invalidate();
     if (config.cy == config.nrows)
         return;
     if (config.cx == 0 && config.cy == 0)
         return;
-    erow *row = &config.row[config.cy];
+    int row0 = config.cy, col0 = config.cx, mods = config.nmodifications;
+    erow *row = editor_row_at(config.cy);
     if (config.cx > 0) {
-        editor_row_del_char(&config.row[config.cy], config.cx);
+        editor_row_del_char(row, config.cx);
+        editor_syntax_changed(config.cy);
         config.cx--;
     } else {
-        config.cx = config.row[config.cy - 1].size; // -1?
-        editor_row_append_string(&config.row[config.cy - 1], row->chars,
-                                 row->size);
+        erow *prev = editor_row_at(config.cy - 1);
+        config.cx = prev->size; // -1?
+        editor_row_append_string(prev, row->chars, row->size);
         editor_del_row(config.cy);
         config.cy--;
+        editor_syntax_changed(config.cy);
     }
+    editor_journal_delete(row0, col0, mods);
 }
 /*** file i/o ***/
-char *editor_rows_to_string(int *buflen) {
-    size_t totlen = 0;
-    size_t j;
-    for (j = 0; j < config.nrows; j++)
-        totlen += config.row[j].size + 1;
-    *buflen = totlen;
-    char *buf = malloc(totlen + 1);
-    char *p = buf;
-    for (size_t i = 0; i < config.nrows; i++) {
-        memcpy(p, config.row[i].chars, config.row[i].size);
-        p += config.row[i].size;
-        *p = '\n';
-        p++;
+struct load_index {
+    char *slab;
+    size_t len;
+    struct memscan_index lines;
+};
+void editor_fill_loaded_row(erow *row, unsigned at, void *arg) {
+    struct load_index *idx = arg;
+    size_t start = at ? idx->lines.offsets[at - 1] + 1 : 0;
+    size_t end = at < idx->lines.count ? idx->lines.offsets[at] : idx->len;
+    while (end > start && idx->slab[end - 1] == '\r')
+        end--;
+    idx->slab[end] = '\0';
+    row->chars = &idx->slab[start];
+    row->size = end - start;
+    row->borrowed = 1;
+    editor_update_row(row);
+}
+/*
+ Replays the journal a crash left next to the file through the same
+ operations that recorded it, leaving the buffer modified as it was. A
+ record that does not fit the buffer ends the replay there.
+*/
+void editor_journal_replay(const char *filename, const struct stat *st) {
+    char *path = realpath(filename, NULL);
+    ej_init(&config.journal, path ? path : filename, st);
+    free(path);
+    int n = ej_load(&config.journal);
+    if (n == -1) {
+        editor_set_status_msg("Journal %s left alone: %s",
+                              config.journal.path,
+                              config.journal.err == EEXIST
+                                  ? "the file changed since"
+                                  : strerror(config.journal.err));
+        return;
     }
-    return buf;
+    config.replaying = 1;
+    int i;
+    for (i = 0; i < n; i++) {
+        struct ej_record *r = &config.journal.recs[i];
+        if (r->row > (unsigned)config.nrows ||
+            r->col > (r->row < (unsigned)config.nrows
+                          ? (unsigned)editor_row_at(r->row)->size
+                          : 0))
+            break;
+        config.cy = r->row;
+        config.cx = r->col;
+        if (r->type == EJ_DELETE) {
+            for (unsigned k = 0; k < r->n; k++)
+                editor_del_char();
+            continue;
+        }
+        if (config.cy == config.nrows)
+            editor_append_line(config.nrows, "", 0);
+        editor_insert_text(r->text, r->n);
+    }
+    config.replaying = 0;
+    config.cx = config.cy = 0;
+    ej_drop(&config.journal, i);
+    if (n)
+        editor_set_status_msg("Recovered %d of %d edits from %s", i, n,
+                              config.journal.path);
 }
+/*
+ The whole file is read into one slab with a single pass of read() calls,
+ lines are found with a vectorized newline scan, and rows point straight into
+ the slab until they are edited.
+*/
 void editor_open(const char *filename) {
     free(config.filename);
     config.filename = strdup(filename);
-    editor_select_highlight();
-    FILE *fp = fopen(filename, "r");
-    char *line = NULL;
-    if (!fp)
-        die("fopen");
-    size_t linecap = 0;
-    ssize_t linelen;
-
-    while ((linelen = getline(&line, &linecap, fp)) != -1) {
-        while (linelen > 0 &&
-               (line[linelen - 1] == '\r' || line[linelen - 1] == '\n'))
-            linelen--;
-        if (linelen == 0 && line[0] == '\n')
-            line[linelen++] = ' ';
-        editor_append_line(config.nrows, line, linelen);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+        die("open");
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+        die("fstat");
+    struct load_index idx = {malloc(st.st_size + 1), 0};
+    if (!idx.slab)
+        die("editor_open: slab malloc");
+    while (idx.len < st.st_size) {
+        ssize_t n = read(fd, idx.slab + idx.len, st.st_size - idx.len);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1)
+            die("read");
+        if (n == 0)
+            break;
+        idx.len += n;
     }
+    close(fd);
+    idx.slab[idx.len] = '\0';
+
+    memscan_init(&idx.lines, 1);
+    memscan_newlines(&idx.lines, idx.slab, idx.len, 0);
+    unsigned nrows = idx.lines.count;
+    if (idx.len > 0 && idx.slab[idx.len - 1] != '\n')
+        nrows++;
+    ts_build(&config.rows, nrows, editor_fill_loaded_row, &idx);
+    config.nrows = nrows;
+    config.load_slab = idx.slab;
+    memscan_free(&idx.lines);
     config.nmodifications = 0;
+    editor_select_highlight();
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs =
+        (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    double mb = idx.len / (1024.0 * 1024.0);
+    editor_set_status_msg("Loaded %.1f MB in %.3fs (%.0f MB/s)", mb, secs,
+                          secs > 0 ? mb / secs : 0);
+    editor_journal_replay(filename, &st);
+}
+/*
+ Opens the file as a read-only mmapped view: only a sparse line index is
+ built and rows are materialized as they are visited.
+*/
+void editor_view(const char *filename) {
+    free(config.filename);
+    config.filename = strdup(filename);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (vf_open(&config.view, filename, editor_build_view_row,
+                editor_free_view_row) == -1)
+        die("vf_open");
+    config.read_only = 1;
+    config.nrows = config.view.nrows;
+    editor_select_highlight();
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs =
+        (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    editor_set_status_msg("Viewing %.1f MB read-only, indexed in %.3fs",
+                          config.view.len / (1024.0 * 1024.0), secs);
 }
+void editor_save_notified(void *arg);
+/*
+ The rows are written from a snapshot on the save worker, so editing goes on
+ at once. Edits made meanwhile are counted past the ones the snapshot holds,
+ and are still modifications when the save completes.
+*/
 void editor_save() {
+    if (editor_check_read_only())
+        return;
+    if (config.save.job) {
+        editor_set_status_msg("A save is already in progress");
+        return;
+    }
     if (config.filename == NULL) {
         config.filename = editor_prompt("Save as: %s (ESC to cancel)", NULL);
         if (!config.filename) {
@@ -604,45 +1826,229 @@ void editor_save() {
         }
         editor_select_highlight();
     }
-    int len;
-    char *buf = editor_rows_to_string(&len);
-    int fd = open(config.filename, O_RDWR | O_CREAT, 0644);
-    if (fd != -1) {
-        if (ftruncate(fd, len) != -1) {
-            if (write(fd, buf, len) == len) {
-                close(fd);
-                free(buf);
-                const time_t saved = time(NULL);
-                struct tm *time = localtime(&saved);
-                char save_msg[50];
-                snprintf(save_msg, sizeof(save_msg), "Saved at %d:%d:%d",
-                         time->tm_hour, time->tm_min, time->tm_sec);
-                editor_set_status_msg(save_msg);
-                config.nmodifications = 0;
-                return;
-            }
-        }
-        close(fd);
+    clock_gettime(CLOCK_MONOTONIC, &config.save.start);
+    // rename() would replace a symlink itself, so write next to its target
+    char *path = realpath(config.filename, NULL);
+    text_store snap;
+    ts_snapshot(&config.rows, &snap);
+    config.save.job = sv_submit(&snap, path ? path : config.filename);
+    config.save.nmodifications = config.nmodifications;
+    config.save.reported = 0;
+    if (!config.journal.path)
+        ej_init(&config.journal, path ? path : config.filename, NULL);
+    config.save.journal_mark = ej_seal(&config.journal);
+    free(path);
+    ev_watch(sv_notify_fd(), editor_save_notified, NULL);
+    editor_set_status_msg("Saving...");
+}
+/*
+ Gives back the snapshot, and the chars edits dropped while it was being
+ written, once the result is shown. A search scans a snapshot of its own,
+ which holds on to the nodes it shares with this one.
+*/
+void editor_save_reap() {
+    sv_job *job = config.save.job;
+    if (!job || !config.save.reported)
+        return;
+    text_store snap = job->rows;
+    sv_free(job);
+    ts_free(&snap, NULL);
+    config.save.job = NULL;
+    for (unsigned i = 0; i < config.save.ndeferred; i++)
+        ra_free(&config.arena, config.save.deferred[i].chars,
+                config.save.deferred[i].cap);
+    config.save.ndeferred = 0;
+}
+// shows how far the save got, and its result once it is over
+void editor_save_notified(void *arg) {
+    (void)arg;
+    sv_drain_notify();
+    sv_job *job = config.save.job;
+    if (!job || config.save.reported)
+        return;
+    config.frame.due = 1;
+    unsigned done;
+    if (!sv_progress(job, &done)) {
+        editor_set_status_msg("Saving... %u%%",
+                              job->nrows ? (unsigned)(100ULL * done /
+                                                      job->nrows)
+                                         : 0);
+        return;
     }
-    free(buf);
-    editor_set_status_msg("Can't save! Error: %s", strerror(errno));
+    config.save.reported = 1;
+    ev_unwatch(sv_notify_fd());
+    if (job->err) {
+        editor_set_status_msg("Can't save! Error: %s", strerror(job->err));
+    } else {
+        config.nmodifications -= config.save.nmodifications;
+        // the edits since the snapshot are journaled against the new file
+        struct stat st;
+        if (stat(job->target, &st) == 0)
+            ej_rebase(&config.journal, config.save.journal_mark, &st);
+        struct timespec end;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double secs = (end.tv_sec - config.save.start.tv_sec) +
+                      (end.tv_nsec - config.save.start.tv_nsec) / 1e9;
+        double mb = job->bytes / (1024.0 * 1024.0);
+        editor_set_status_msg("Saved %.1f MB in %.3fs (%.0f MB/s)", mb, secs,
+                              secs > 0 ? mb / secs : 0);
+    }
+    editor_save_reap();
 }
 /*** append-buffer ***/
-struct abuf {
-    char *b;
-    size_t len;
-};
-#define ABUF_INIT                                                              \
-    { NULL, 0 }
+// grows geometrically; resetting len keeps the memory for the next frame
 void ab_append(struct abuf *ab, const char *s, size_t len) {
-    char *new = realloc(ab->b, ab->len + len);
-    if (!new)
-        return;
-    memcpy(&new[ab->len], s, len);
-    ab->b = new;
+    if (ab->len + len > ab->cap) {
+        size_t cap = ab->cap ? ab->cap : 4096;
+        while (cap < ab->len + len)
+            cap *= 2;
+        char *new = realloc(ab->b, cap);
+        if (!new)
+            return;
+        ab->b = new;
+        ab->cap = cap;
+    }
+    memcpy(&ab->b[ab->len], s, len);
     ab->len += len;
 }
-void ab_free(struct abuf *ab) { free(ab->b); }
+void ab_free(struct abuf *ab) {
+    free(ab->b);
+    ab->b = NULL;
+    ab->len = ab->cap = 0;
+}
+/*** frame ***/
+uint64_t frame_hash(struct frame_row *r, unsigned ncols) {
+    uint64_t h = 14695981039346656037ull;
+    for (unsigned i = 0; i < ncols; i++)
+        h = ((h ^ (unsigned char)r->ch[i]) * 1099511628211ull ^ r->attr[i]) *
+            1099511628211ull;
+    return h;
+}
+void frame_row_clear(struct frame_row *r, unsigned ncols) {
+    memset(r->ch, ' ', ncols);
+    memset(r->attr, 0, ncols);
+    r->hash = frame_hash(r, ncols);
+}
+void frame_row_alloc(struct frame_row *r, unsigned ncols) {
+    r->ch = malloc(ncols ? ncols : 1);
+    r->attr = malloc(ncols ? ncols : 1);
+    if (!r->ch || !r->attr)
+        die("frame_row_alloc");
+    frame_row_clear(r, ncols);
+}
+// matches the frame to the window; a new size means a full repaint
+void frame_fit() {
+    struct frame *f = &config.frame;
+    unsigned nrows = config.scrnrows + 2, ncols = config.scrncols;
+    if (f->rows && f->nrows == nrows && f->ncols == ncols)
+        return;
+    if (!f->rows) {
+        for (int a = 0; a < 256; a++) {
+            if (a == HL_NORMAL)
+                f->sgr[a].len = snprintf(f->sgr[a].s, 12, "\x1b[m");
+            else if (a == ATTR_INVERSE)
+                f->sgr[a].len = snprintf(f->sgr[a].s, 12, "\x1b[0;7m");
+            else
+                f->sgr[a].len = snprintf(f->sgr[a].s, 12, "\x1b[0;%dm",
+                                         editor_syntax_to_color(a));
+        }
+    }
+    for (unsigned y = 0; f->rows && y <= f->nrows; y++) {
+        struct frame_row *r = y < f->nrows ? &f->rows[y] : &f->next;
+        free(r->ch);
+        free(r->attr);
+    }
+    free(f->rows);
+    f->rows = malloc(sizeof(struct frame_row) * nrows);
+    if (!f->rows)
+        die("frame_fit");
+    f->nrows = nrows;
+    f->ncols = ncols;
+    for (unsigned y = 0; y < nrows; y++)
+        frame_row_alloc(&f->rows[y], ncols);
+    frame_row_alloc(&f->next, ncols);
+    f->valid = 0;
+}
+// writes len cells of s at column x of the row being composed
+void frame_put(unsigned x, const char *s, size_t len, unsigned char attr) {
+    struct frame *f = &config.frame;
+    if (x >= f->ncols)
+        return;
+    if (len > f->ncols - x)
+        len = f->ncols - x;
+    memcpy(&f->next.ch[x], s, len);
+    memset(&f->next.attr[x], attr, len);
+}
+void frame_sgr(struct abuf *ab, unsigned char attr) {
+    ab_append(ab, config.frame.sgr[attr].s, config.frame.sgr[attr].len);
+}
+/*
+ Compares the composed row with what screen row y shows and emits only the
+ span between the first and the last changed cell. Blank cells at the end
+ of the span are cleared with EL instead of being written out.
+*/
+void frame_flush_row(struct abuf *ab, unsigned y) {
+    struct frame *f = &config.frame;
+    struct frame_row *old = &f->rows[y], *cur = &f->next;
+    cur->hash = frame_hash(cur, f->ncols);
+    if (cur->hash == old->hash)
+        return;
+    unsigned first = 0, last = f->ncols, end = f->ncols;
+    while (first < f->ncols && cur->ch[first] == old->ch[first] &&
+           cur->attr[first] == old->attr[first])
+        first++;
+    while (last > first && cur->ch[last - 1] == old->ch[last - 1] &&
+           cur->attr[last - 1] == old->attr[last - 1])
+        last--;
+    while (end > 0 && cur->ch[end - 1] == ' ' &&
+           cur->attr[end - 1] == HL_NORMAL)
+        end--;
+    if (first < last) {
+        char buf[32];
+        int len = snprintf(buf, sizeof(buf), "\x1b[%u;%uH", y + 1, first + 1);
+        ab_append(ab, buf, len);
+        int attr = -1;
+        unsigned stop = last < end ? last : end;
+        // one copy per run of cells sharing an attribute
+        for (unsigned x = first, run; x < stop; x = run) {
+            for (run = x + 1; run < stop && cur->attr[run] == cur->attr[x];)
+                run++;
+            if (cur->attr[x] != attr)
+                frame_sgr(ab, attr = cur->attr[x]);
+            ab_append(ab, &cur->ch[x], run - x);
+        }
+        if (last > end) {
+            if (attr != HL_NORMAL && attr != -1)
+                frame_sgr(ab, HL_NORMAL);
+            ab_append(ab, "\x1b[K", 3);
+        }
+    }
+    // the composed row becomes the shown one, its buffers are reused next
+    struct frame_row tmp = *old;
+    *old = *cur;
+    *cur = tmp;
+}
+/*
+ Moves the text rows by d lines (up when positive) with a scroll region
+ around them, so only the rows that come into view have to be sent.
+*/
+void frame_scroll(struct abuf *ab, long d) {
+    struct frame *f = &config.frame;
+    unsigned h = config.scrnrows, k = d > 0 ? d : -d;
+    char buf[48];
+    int len = snprintf(buf, sizeof(buf), "\x1b[m\x1b[1;%ur\x1b[%u%c\x1b[r",
+                       h, k, d > 0 ? 'S' : 'T');
+    ab_append(ab, buf, len);
+    struct frame_row *tmp = malloc(sizeof(struct frame_row) * h);
+    if (!tmp)
+        die("frame_scroll");
+    for (unsigned y = 0; y < h; y++)
+        tmp[(y + h - (d > 0 ? k : h - k)) % h] = f->rows[y];
+    for (unsigned y = 0; y < k; y++)
+        frame_row_clear(&tmp[d > 0 ? h - 1 - y : y], f->ncols);
+    memcpy(f->rows, tmp, sizeof(struct frame_row) * h);
+    free(tmp);
+}
 /*** terminal ***/
 int get_cursor_position(unsigned *rows, unsigned *cols) {
     char buf[32];
@@ -650,7 +2056,8 @@ int get_cursor_position(unsigned *rows, unsigned *cols) {
     if (write(STDOUT_FILENO, "\x1b[6n", 4) != 4)
         return -1;
     while (i < sizeof(buf) - 1) {
-        if (read(STDIN_FILENO, &buf[i], 1) != 1)
+        struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+        if (poll(&pfd, 1, 1000) != 1 || read(STDIN_FILENO, &buf[i], 1) != 1)
             break;
         if (buf[i] == 'R')
             break;
@@ -676,42 +2083,102 @@ int get_win_size(unsigned *rows, unsigned *cols) {
         return 0;
     }
 }
+// sizes the text area to the window, leaving two rows for the bars
+int editor_fit_window() {
+    unsigned rows, cols;
+    if (get_win_size(&rows, &cols) == -1)
+        return -1;
+    config.scrnrows = rows > 2 ? rows - 2 : 1;
+    config.scrncols = cols ? cols : 1;
+    return 0;
+}
+/*
+ Lays the view out again for a new window size: the offsets are pulled back
+ so a grown window shows text rather than blank rows, the cursor is kept in
+ view, and the frame cache is dropped because the terminal may have
+ reflowed or cleared what it showed. Painting is left to the event loop.
+*/
+void editor_relayout(void *arg) {
+    (void)arg;
+    config.resize_since = 0;
+    if (editor_fit_window() == -1)
+        return;
+    if (config.rowoff + config.scrnrows > config.nrows)
+        config.rowoff =
+            config.nrows > config.scrnrows ? config.nrows - config.scrnrows : 0;
+    if (config.rx < config.scrncols)
+        config.coloff = 0;
+    editor_scroll();
+    config.frame.valid = 0;
+    config.frame.due = 1;
+}
+/*
+ SIGWINCH only schedules the relayout. Dragging a pane sends a storm of
+ signals, and they end up in one relayout once the size has held still for
+ IEXOT_RESIZE_NS, or IEXOT_RESIZE_MAX_NS into the storm at the latest.
+*/
+void editor_resize(void *arg) {
+    (void)arg;
+    long long now = ev_now_ns();
+    if (!config.resize_since)
+        config.resize_since = now;
+    long long left = config.resize_since + IEXOT_RESIZE_MAX_NS - now;
+    if (left > IEXOT_RESIZE_NS)
+        left = IEXOT_RESIZE_NS;
+    ev_timer(editor_relayout, NULL, left > 0 ? left : 0);
+}
 void editor_init() {
     config.nrows = 0;
     config.rowoff = 0;
     config.coloff = 0;
-    config.row = NULL;
+    ts_init(&config.rows);
+    config.rows.share_row = editor_share_row;
+    config.load_slab = NULL;
+    config.read_only = 0;
     config.filename = NULL;
     config.cx = config.cy = config.rx;
     config.saved_cx = config.saved_cy = 0;
     config.prevx = 0;
-    config.flag_mv_line = 0;
-    if (get_win_size(&config.scrnrows, &config.scrncols) == -1)
+    if (editor_fit_window() == -1)
         die("get_win_size");
-    config.scrnrows -=
-        2; // decrementing 2 lines for status bar and status message
     config.status_msg[0] = '\0';
     config.status_msg_time = 0;
     config.nmodifications = 0;
-    config.search_list_head = NULL;
-    config.search_list_tail = NULL;
-    config.current_search_match = NULL;
+    memset(&config.search, 0, sizeof(config.search));
+    memset(&config.frame, 0, sizeof(config.frame));
+    config.search.pattern = strdup("");
     config.syntax = NULL;
+    config.journal.fd = -1;
+    editor_init_byte_class();
+    ev_watch(STDIN_FILENO, editor_read_input, NULL);
+    ev_signal(SIGWINCH, editor_resize, NULL);
 }
 void editor_destroy() {
+    editor_search_stop();
+    editor_syntax_stop();
+    // a save in flight is let finish rather than left half written
+    if (config.save.job)
+        sv_free(config.save.job);
+    ej_discard(&config.journal);
     write(STDIN_FILENO, "\x1b[2J", 4);
     write(STDIN_FILENO, "\x1b[H", 3);
-    erow_free(config.row);
-    free(config.current_search_match);
+    // every row's storage goes back at once with the arena
+    ts_free(&config.rows, NULL);
+    free(config.load_slab);
+    if (config.read_only)
+        vf_close(&config.view);
+    ra_release(&config.arena);
     exit(0);
 }
 void die(const char *s) {
+    ej_flush(&config.journal); // so what was typed can be recovered
     write(STDIN_FILENO, "\x1b[2J", 4);
     write(STDIN_FILENO, "\x1b[H", 3);
     perror(s);
     exit(1);
 }
 void disable_raw_mode() {
+    write(STDOUT_FILENO, "\x1b[?2004l", 8);
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &config.orig_termios) == -1)
         die("tcsetattr");
 }
@@ -725,18 +2192,61 @@ void enable_raw_mode() {
     raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
     raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
     raw.c_lflag |= (CS8);
-    raw.c_cc[VMIN] = 0;
-    raw.c_cc[VTIME] = 10;
+    raw.c_cc[VMIN] = 1; // reads only happen once poll() saw input
+    raw.c_cc[VTIME] = 0;
 
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1)
         die("tcsetattr");
+    write(STDOUT_FILENO, "\x1b[?2004h", 8); // pastes arrive bracketed
 }
 
 /*** output ***/
+/*
+ Lays out the visible part of a row into the next frame straight from its
+ chars and spans: the first character is found through the tab index, tabs
+ are expanded here, and nothing past the right edge is looked at.
+*/
+void editor_draw_row(erow *row) {
+    struct frame *f = &config.frame;
+    int cx = editor_rx_to_cx(row, config.coloff);
+    int rx = editor_cx_to_rx(row, cx); // less than coloff inside a tab
+    int lo = 0, hi = row->nspans;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (row->spans[mid].start + row->spans[mid].len <= (unsigned)cx)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    struct hl_span *sp = row->spans + lo, *end = row->spans + row->nspans;
+    int x = 0;
+    for (; cx < row->size && x < (int)config.scrncols; cx++) {
+        while (sp < end && sp->start + sp->len <= (unsigned)cx)
+            sp++;
+        unsigned char attr =
+            sp < end && sp->start <= (unsigned)cx ? sp->hl : HL_NORMAL;
+        if (row->chars[cx] != '\t') {
+            f->next.ch[x] = row->chars[cx];
+            f->next.attr[x++] = attr;
+            rx++;
+            continue;
+        }
+        int next = rx + IEXOT_TAB_WIDTH - rx % IEXOT_TAB_WIDTH;
+        for (; rx < next && x < (int)config.scrncols; rx++)
+            if (rx >= (int)config.coloff) {
+                f->next.ch[x] = ' ';
+                f->next.attr[x++] = attr;
+            }
+    }
+}
+// composes every text row into the frame and flushes what changed
 void editor_draw_rows(struct abuf *ab) {
+    struct frame *f = &config.frame;
     size_t y;
     for (y = 0; y < config.scrnrows; ++y) {
         size_t filerow = y + config.rowoff;
+        memset(f->next.ch, ' ', f->ncols);
+        memset(f->next.attr, HL_NORMAL, f->ncols);
         if (filerow >= config.nrows) {
             if (config.nrows == 0 && y == IEXOT_TITLE_TOP_PADDING) {
                 char welcome[80];
@@ -746,87 +2256,70 @@ void editor_draw_rows(struct abuf *ab) {
                     welcomelen = config.scrncols;
                 int padding = (config.scrncols - welcomelen) / 2 -
                               1; // -1 because of tilda
-                if (padding) {
-                    ab_append(ab, "~", 1);
-                    padding--;
-                }
-                while (padding--) {
-                    ab_append(ab, " ", 1);
-                }
-                ab_append(ab, welcome, welcomelen);
+                frame_put(0, "~", 1, HL_NORMAL);
+                frame_put(padding > 0 ? padding : 0, welcome, welcomelen,
+                          HL_NORMAL);
             } else if (config.nrows == 0 && y > IEXOT_TITLE_TOP_PADDING) {
-                ab_append(ab, "~", 1);
+                frame_put(0, "~", 1, HL_NORMAL);
             }
         } else {
-            int len = config.row[filerow].rsize - config.coloff;
-            if (len < 0)
-                len = 0;
-            if (len > config.scrncols)
-                len = config.scrncols;
-            char *c = &config.row[filerow].render[config.coloff];
-            unsigned char *hl = &config.row[filerow].hl[config.coloff];
-            int cur_color = -1;
-            for (size_t j = 0; j < len; j++) {
-                if (hl[j] == HL_NORMAL) {
-                    if (cur_color != -1) {
-                        ab_append(ab, "\x1b[39m", 5);
-                        cur_color = -1;
-                    }
-                    ab_append(ab, &c[j], 1);
-                } else {
-                    int color = editor_syntax_to_color(hl[j]);
-                    if (cur_color != color) {
-                        cur_color = color;
-                        char buf[16];
-                        int clen =
-                            snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-                        ab_append(ab, buf, clen);
-                    }
-                    ab_append(ab, &c[j], 1);
-                }
-            }
-            ab_append(ab, "\x1b[39m", 5);
-            // ab_append(ab, c, len);
+            erow *row = editor_row_at(filerow);
+            editor_render_row(row, filerow);
+            editor_draw_row(row);
         }
-        ab_append(ab, "\x1b[K", 3); // escape sequence to clear the screen
-        if (y < config.scrnrows)
-            ab_append(ab, "\r\n", 2);
+        frame_flush_row(ab, y);
     }
 }
 void editor_draw_statusbar(struct abuf *ab) {
-    ab_append(ab, "\x1b[7m", 4);
+    struct frame *f = &config.frame;
     char lstatus[100], rstatus[100];
     int l_len =
-        snprintf(lstatus, sizeof(lstatus), "\"%.20s\"%s | %d lines",
+        snprintf(lstatus, sizeof(lstatus), "\"%.20s\"%s%s | %d lines",
                  config.filename ? config.filename : "[Unknown]",
+                 config.read_only ? " (view)" : "",
                  config.nmodifications > 0 ? " (modified)" : "", config.nrows);
-    int r_len = snprintf(rstatus, sizeof(rstatus), "%s | %d : %d : %d",
+    char counter[32] = "";
+    struct search_state *s = &config.search;
+    if (s->active && s->pattern[0]) {
+        unsigned i = editor_search_at_cursor();
+        if (editor_search_pending())
+            snprintf(counter, sizeof(counter), "%u+ | ", s->matches.n);
+        else if (i < s->matches.n)
+            snprintf(counter, sizeof(counter), "%u/%u | ", i + 1,
+                     s->matches.n);
+        else
+            snprintf(counter, sizeof(counter), "-/%u | ", s->matches.n);
+    }
+    int r_len = snprintf(rstatus, sizeof(rstatus), "%s%s | %d : %d : %d",
+                         counter,
                          config.syntax ? config.syntax->filetype : "no ft",
                          config.cy + 1, config.cx + 1, config.nrows);
     if (l_len > config.scrncols)
         l_len = config.scrncols;
     if (r_len > config.scrncols - l_len)
         r_len = config.scrncols - l_len;
-    ab_append(ab, lstatus, l_len);
-    while (l_len < config.scrncols) {
-        if (config.scrncols - l_len == r_len) {
-            ab_append(ab, rstatus, r_len);
-            break;
-        } else {
-            ab_append(ab, " ", 1);
-            l_len++;
-        }
-    }
-    ab_append(ab, "\x1b[m", 3);
-    ab_append(ab, "\r\n", 2);
+    memset(f->next.ch, ' ', f->ncols);
+    memset(f->next.attr, ATTR_INVERSE, f->ncols);
+    frame_put(0, lstatus, l_len, ATTR_INVERSE);
+    frame_put(config.scrncols - r_len, rstatus, r_len, ATTR_INVERSE);
+    frame_flush_row(ab, config.scrnrows);
 }
 void editor_draw_messagebar(struct abuf *ab) {
-    ab_append(ab, "\x1b[K", 3);
+    struct frame *f = &config.frame;
+    memset(f->next.ch, ' ', f->ncols);
+    memset(f->next.attr, HL_NORMAL, f->ncols);
     int msglen = strlen(config.status_msg);
     if (msglen > config.scrncols)
         msglen = config.scrncols;
-    if (msglen && time(NULL) - config.status_msg_time < 1)
-        ab_append(ab, config.status_msg, msglen);
+    if (msglen && (config.status_sticky ||
+                   time(NULL) - config.status_msg_time < IEXOT_STATUS_MSG_SECS))
+        frame_put(0, config.status_msg, msglen, HL_NORMAL);
+    frame_flush_row(ab, config.scrnrows + 1);
+}
+void editor_status_msg_expired(void *arg) {
+    (void)arg;
+    if (!config.status_sticky)
+        config.frame.due = 1;
 }
 void editor_set_status_msg(const char *fmt, ...) {
     va_list ap;
@@ -834,11 +2327,13 @@ void editor_set_status_msg(const char *fmt, ...) {
     vsnprintf(config.status_msg, sizeof(config.status_msg), fmt, ap);
     va_end(ap);
     config.status_msg_time = time(NULL);
+    ev_timer(editor_status_msg_expired, NULL,
+             IEXOT_STATUS_MSG_SECS * 1000000000LL);
 }
 void editor_scroll() {
     config.rx = 0;
     if (config.cy < config.nrows)
-        config.rx = editor_cx_to_rx(&config.row[config.cy], config.cx);
+        config.rx = editor_cx_to_rx(editor_row_at(config.cy), config.cx);
 
     if (config.cy < config.rowoff)
         config.rowoff = config.cy;
@@ -850,103 +2345,160 @@ void editor_scroll() {
     if (config.rx >= config.coloff + config.scrncols)
         config.coloff = config.rx - config.scrncols + 1;
 }
+/*
+ Repaints by difference against the last frame: when only the cursor moved
+ nothing but the cursor position is sent, and when the view moved by a few
+ lines the terminal scrolls the rows it already shows.
+*/
 void editor_clear_scrn() {
+    struct frame *f = &config.frame;
     editor_scroll();
-    struct abuf ab = ABUF_INIT;
+    frame_fit();
+    struct abuf ab = f->out;
+    ab.len = 0;
     ab_append(&ab, "\x1b[?25l", 6); // hide the cursor when repainting
-    ab_append(&ab, "\x1b[H", 3);    // escape sequence to move the cursor
+    if (!f->valid) {
+        ab_append(&ab, "\x1b[m\x1b[2J", 7);
+        for (unsigned y = 0; y < f->nrows; y++)
+            frame_row_clear(&f->rows[y], f->ncols);
+        f->valid = 1;
+    } else if (f->coloff == config.coloff && f->rowoff != config.rowoff) {
+        long d = (long)config.rowoff - (long)f->rowoff;
+        if (d < (long)config.scrnrows && -d < (long)config.scrnrows)
+            frame_scroll(&ab, d);
+    }
+    f->rowoff = config.rowoff;
+    f->coloff = config.coloff;
 
     editor_draw_rows(&ab);
     editor_draw_statusbar(&ab);
     editor_draw_messagebar(&ab);
     char buf[100];
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", config.cy - config.rowoff + 1,
-             config.rx - config.coloff + 1); // updating cursor position
-
-    ab_append(&ab, buf, strlen(buf));
+    int len = snprintf(buf, sizeof(buf), "\x1b[m\x1b[%d;%dH",
+                       config.cy - config.rowoff + 1,
+                       config.rx - config.coloff + 1); // cursor position
+    ab_append(&ab, buf, len);
     ab_append(&ab, "\x1b[?25h", 6);
 
-    write(STDOUT_FILENO, ab.b, ab.len);
-    ab_free(&ab);
+    // the whole frame goes out in one write unless the tty takes less
+    for (size_t off = 0; off < ab.len;) {
+        ssize_t n = write(STDOUT_FILENO, ab.b + off, ab.len - off);
+        if (n == -1 && errno != EINTR && errno != EAGAIN)
+            break;
+        if (n > 0)
+            off += n;
+    }
+    f->last_bytes = ab.len;
+    f->total_bytes += ab.len;
+    f->frames++;
+    f->out = ab;
+    clock_gettime(CLOCK_MONOTONIC, &f->painted);
+    f->lagging = 0;
+    f->due = 0;
+}
+/*
+ Paints the screen unless more keys are already waiting: a burst of input
+ (auto-repeat, a paste) is applied key by key and painted once at the end.
+ A long burst still paints once its oldest unpainted key is
+ IEXOT_LATENCY_NS old, but no faster than IEXOT_FRAME_NS, and a lone
+ keystroke always paints at once.
+*/
+void editor_refresh() {
+    struct frame *f = &config.frame;
+    editor_scroll(); // keys like page down work from the scrolled view
+    if (editor_input_pending()) {
+        if (!f->lagging) {
+            clock_gettime(CLOCK_MONOTONIC, &f->behind);
+            f->lagging = 1;
+        }
+        if (editor_elapsed_ns(&f->behind) < IEXOT_LATENCY_NS ||
+            editor_elapsed_ns(&f->painted) < IEXOT_FRAME_NS) {
+            f->skipped++;
+            return;
+        }
+    }
+    editor_clear_scrn();
 }
 
 /*** input ***/
-int editor_read_key() {
-    int nread;
+/*
+ Terminal input is read in blocks of whatever is available, from the event
+ loop, and keys are decoded out of that buffer. A burst of keys costs one
+ read and editor_input_pending() can tell that more keys follow.
+*/
+void editor_read_input(void *arg) {
+    (void)arg;
+    if (config.input.pos > 0) {
+        memmove(config.input.buf, &config.input.buf[config.input.pos],
+                config.input.len - config.input.pos);
+        config.input.len -= config.input.pos;
+        config.input.pos = 0;
+    }
+    if (config.input.len == IEXOT_INPUT_BUF)
+        return;
+    int n = read(STDIN_FILENO, &config.input.buf[config.input.len],
+                 IEXOT_INPUT_BUF - config.input.len);
+    if (n == 0 || (n == -1 && errno != EINTR && errno != EAGAIN))
+        die("read"); // the terminal is gone
+    if (n > 0)
+        config.input.len += n;
+}
+/*
+ Takes the next input byte, running the event loop until one arrives or
+ timeout_ns runs out (never, when negative). While waiting for a key, a
+ screen that something else changed is repainted.
+*/
+int editor_read_byte(char *c, long long timeout_ns) {
+    long long deadline = config.input.pos < config.input.len
+                             ? 0
+                             : ev_now_ns() + timeout_ns;
+    while (config.input.pos == config.input.len) {
+        long long left = timeout_ns < 0 ? -1 : deadline - ev_now_ns();
+        if (timeout_ns >= 0 && left <= 0)
+            return 0;
+        if (timeout_ns < 0 && config.frame.due)
+            editor_refresh();
+        ev_wait(left);
+    }
+    *c = config.input.buf[config.input.pos++];
+    return 1;
+}
+int editor_input_pending() {
+    if (config.input.pos < config.input.len)
+        return 1;
+    struct pollfd pfd = {STDIN_FILENO, POLLIN, 0};
+    return poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN);
+}
+// collects a bracketed paste into config.paste, up to the closing ESC[201~
+void editor_read_paste() {
+    static const char close[] = "\x1b[201~";
+    size_t matched = 0;
     char c;
-    while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
-        // if(nread != -1 && errno != EAGAIN)
-        // 	exit(0);
-    }
-    if (c == '\x1b') {
-        char seq[3];
-        if (read(STDIN_FILENO, &seq[0], 1) != 1 ||
-            read(STDIN_FILENO, &seq[1], 1) != 1)
-            return '\x1b';
-        if (seq[0] == '[') {
-            if (seq[1] > '0' && seq[1] <= '9') {
-                if (read(STDIN_FILENO, &seq[2], 1) == -1)
-                    return '\x1b';
-                if (seq[2] == '~') {
-                    /*
-                     Switch statement for sequences ends with '~', e.g
-                     PAGE UP KEY - <Esc>[5~
-                     HOME    KEY - <Esc>[7~
-                    */
-                    switch (seq[1]) {
-                    case '1':
-                        return HOME_KEY;
-                    case '3':
-                        return DEL_KEY;
-                    case '4':
-                        return END_KEY;
-                    case '5':
-                        return PAGE_UP;
-                    case '6':
-                        return PAGE_DOWN;
-                    case '7':
-                        return HOME_KEY;
-                    case '8':
-                        return END_KEY;
-                    }
-                }
-            } else {
-                /*
-                 Switch statement for sequences starts with '[', e.g
-                 UP KEY   - <Esc>[A
-                 HOME KEY - <Esc>[F
-                */
-                switch (seq[1]) {
-                case 'A':
-                    return ARROW_UP;
-                case 'B':
-                    return ARROW_DOWN;
-                case 'C':
-                    return ARROW_RIGHT;
-                case 'D':
-                    return ARROW_LEFT;
-                case 'F':
-                    return END_KEY;
-                case 'H':
-                    return HOME_KEY;
-                default:
-                    return '\x1b';
-                }
-            }
-        } else if (seq[0] == 'O') {
-            /*
-             Switch statement for sequences starts with 'O', e.g
-             END  KEY - <Esc>OF
-             HOME KEY - <Esc>OH
-            */
-            switch (seq[1]) {
-            case 'H':
-                return HOME_KEY;
-            case 'F':
-                return END_KEY;
-            }
+    config.paste.len = 0;
+    while (matched < sizeof(close) - 1 &&
+           editor_read_byte(&c, IEXOT_PASTE_NS)) {
+        if (config.paste.len + 1 >= config.paste.cap) {
+            config.paste.cap = config.paste.cap ? config.paste.cap * 2 : 4096;
+            config.paste.buf = realloc(config.paste.buf, config.paste.cap);
+            if (!config.paste.buf)
+                die("editor_read_paste: realloc");
         }
-    } else {
+        config.paste.buf[config.paste.len++] = c;
+        matched = c == close[matched] ? matched + 1 : c == close[0];
+    }
+    if (matched == sizeof(close) - 1)
+        config.paste.len -= matched;
+}
+/*
+ Decodes one key. Escape sequences are read whole, parameters and all, so
+ keys the editor does not know (F5 is ESC[15~) are dropped instead of
+ leaking their tail into the text; a lone ESC is told apart by the
+ IEXOT_ESC_NS pause after it.
+*/
+int editor_read_key() {
+    char c;
+    editor_read_byte(&c, -1);
+    if (c != '\x1b') {
         switch (c) {
         case CTRL_KEY('h'):
             return ARROW_LEFT;
@@ -957,61 +2509,144 @@ int editor_read_key() {
         case CTRL_KEY('l'):
             return ARROW_RIGHT;
         }
+        return c;
+    }
+    char intro, final;
+    if (!editor_read_byte(&intro, IEXOT_ESC_NS))
+        return '\x1b';
+    if (intro == 'O') {
+        // ESC O x, sent for home and end by some terminals
+        if (!editor_read_byte(&final, IEXOT_ESC_NS))
+            return '\x1b';
+        return final == 'H' ? HOME_KEY : final == 'F' ? END_KEY : '\x1b';
+    }
+    if (intro != '[')
+        return '\x1b';
+    // ESC [ parameters final, e.g. ESC[A (up), ESC[5~ (page up)
+    int param = 0, first = 1;
+    while (1) {
+        if (!editor_read_byte(&final, IEXOT_ESC_NS))
+            return '\x1b';
+        if (final >= '0' && final <= '9') {
+            if (first)
+                param = param * 10 + final - '0';
+        } else if (final == ';' || final == ':') {
+            first = 0; // modifiers, as in ESC[1;5A, are ignored
+        } else if (final < 0x30 || final > 0x3f)
+            break;
+    }
+    switch (final) {
+    case 'A':
+        return ARROW_UP;
+    case 'B':
+        return ARROW_DOWN;
+    case 'C':
+        return ARROW_RIGHT;
+    case 'D':
+        return ARROW_LEFT;
+    case 'F':
+        return END_KEY;
+    case 'H':
+        return HOME_KEY;
+    case '~':
+        switch (param) {
+        case 1:
+        case 7:
+            return HOME_KEY;
+        case 3:
+            return DEL_KEY;
+        case 4:
+        case 8:
+            return END_KEY;
+        case 5:
+            return PAGE_UP;
+        case 6:
+            return PAGE_DOWN;
+        case 200:
+            editor_read_paste();
+            return PASTE_KEY;
+        }
+    }
+    return '\x1b';
+}
+/*
+ Moves the cursor n characters right (left when negative), wrapping across
+ line ends like as many arrow presses would, in one step per line crossed.
+*/
+void editor_step_cursor(int n) {
+    while (n > 0 && config.cy < config.nrows) {
+        int room = editor_row_at(config.cy)->size - config.cx;
+        if (n <= room) {
+            config.cx += n;
+            break;
+        }
+        config.cx += room;
+        n -= room;
+        if (config.cy == config.nrows - 1)
+            break;
+        config.cy++;
+        config.cx = 0;
+        n--;
     }
-    return c;
+    while (n < 0) {
+        if (-n <= config.cx) {
+            config.cx += n;
+            break;
+        }
+        n += config.cx;
+        config.cx = 0;
+        if (config.cy == 0)
+            break;
+        config.cy--;
+        config.cx = editor_row_at(config.cy)->size;
+        n++;
+    }
+    config.prevx = 0;
+}
+/*
+ Moves the cursor n rows down (up when negative). config.prevx is the screen
+ column vertical motion aims for, so going through shorter lines or lines
+ with tabs comes back to the same column.
+*/
+void editor_move_rows(int n) {
+    if (config.nrows == 0)
+        return;
+    erow *row = config.cy < (int)config.nrows ? editor_row_at(config.cy)
+                                               : NULL;
+    int rx = row ? editor_cx_to_rx(row, config.cx) : 0;
+    if (rx > config.prevx)
+        config.prevx = rx;
+    int cy = config.cy + n, last = (int)config.nrows - 1;
+    if (n > 0 && cy > last)
+        cy = last;
+    if (n < 0 && cy < 0)
+        cy = 0;
+    if (n == 0 || (n > 0 && cy <= config.cy) || (n < 0 && cy >= config.cy))
+        return;
+    config.cy = cy;
+    row = editor_row_at(cy);
+    config.cx = row ? editor_rx_to_cx(row, config.prevx) : 0;
 }
 void editor_move_cursor(int k) {
-    struct erow *current_row =
-        (config.cy >= config.nrows) ? NULL : &config.row[config.cy];
-    config.flag_mv_line = 0;
     switch (k) {
     case ARROW_LEFT:
-        if (config.cx != 0)
-            config.cx--;
-        else if (config.cx == 0 && config.cy > 0) {
-            config.cy--;
-            config.cx = config.row[config.cy].size;
-        }
-        config.prevx = 0;
+        editor_step_cursor(-1);
         break;
     case ARROW_RIGHT:
-        if (current_row && config.cx < current_row->size)
-            config.cx++;
-        else if (config.cx == config.row[config.cy].size &&
-                 config.cy < config.nrows - 1) {
-            config.cy++;
-            config.cx = 0;
-        }
-        config.prevx = 0;
+        editor_step_cursor(1);
         break;
     case ARROW_UP:
-        if (config.cy != 0) {
-            config.cy--;
-            config.flag_mv_line = 1;
-        }
+        editor_move_rows(-1);
         break;
     case ARROW_DOWN:
-        if (config.cy < config.nrows - 1) {
-            config.cy++;
-            config.flag_mv_line = 1;
-        }
+        editor_move_rows(1);
         break;
     }
-    // TODO: rewrite this shit code.
-    if (config.cx > config.prevx)
-        config.prevx = config.cx;
-    current_row = (config.cy >= config.nrows) ? NULL : &config.row[config.cy];
-    int rowlen = (current_row) ? current_row->size : 0;
-    if(config.flag_mv_line/*  && (config.prevx > rowlen || config.prevx < rowlen) */)
-        config.cx = config.prevx;
-    if (config.flag_mv_line && config.cx > rowlen) {
-        config.cx = rowlen;
-    }
 }
 void editor_process_keypress() {
     int c = editor_read_key();
     struct erow *current_row =
-        (config.cy >= config.nrows) ? NULL : &config.row[config.cy];
+        (config.cy >= config.nrows) ? NULL : editor_row_at(config.cy);
     switch (c) {
     case '\r':
         editor_insert_new_line();
@@ -1043,13 +2678,11 @@ void editor_process_keypress() {
             config.cy = config.rowoff;
         } else if (c == PAGE_DOWN) {
             config.cy = config.scrnrows - 1 + config.rowoff;
-            if (config.cy > config.nrows)
-                config.cy = config.nrows - 1;
-        }
-        int times = config.scrnrows;
-        while (times--) {
-            editor_move_cursor(c == PAGE_UP ? ARROW_UP : ARROW_DOWN);
+            if (config.cy > (int)config.nrows)
+                config.cy = config.nrows ? (int)config.nrows - 1 : 0;
         }
+        editor_move_rows(c == PAGE_UP ? -(int)config.scrnrows
+                                      : (int)config.scrnrows);
         break;
     }
     case HOME_KEY:
@@ -1094,6 +2727,16 @@ void editor_process_keypress() {
         case 'm':
             config.cy = config.nrows / 2;
             break;
+        case 'i':
+            editor_set_status_msg("%lu frames, %lu skipped, last %zu bytes, "
+                                  "%.1f avg",
+                                  config.frame.frames, config.frame.skipped,
+                                  config.frame.last_bytes,
+                                  config.frame.frames
+                                      ? (double)config.frame.total_bytes /
+                                            config.frame.frames
+                                      : 0.0);
+            break;
         }
         break;
     }
@@ -1104,24 +2747,13 @@ void editor_process_keypress() {
         editor_find();
         break;
     case CTRL_KEY('n'): {
-        char ch = editor_read_key();
-        switch (ch) {
-        case 'n':
-            if (config.current_search_match->next)
-                config.current_search_match = config.current_search_match->next;
-            break;
-        case 'p':
-            if (config.current_search_match->prev)
-                config.current_search_match = config.current_search_match->prev;
-            break;
-        }
-        if (config.current_search_match) {
-            config.cy = config.current_search_match->cy;
-            config.cx = editor_chrptr_to_cx(config.current_search_match->p);
-        } else
-            return;
+        int ch = editor_read_key();
+        editor_search_jump(ch == 'n' ? 1 : ch == 'p' ? -1 : 0);
         break;
     }
+    case PASTE_KEY:
+        editor_insert_text(config.paste.buf, config.paste.len);
+        break;
     default:
         editor_insert_char(c);
         break;
@@ -1130,11 +2762,26 @@ void editor_process_keypress() {
 int main(int argc, char **argv) {
     enable_raw_mode();
     editor_init();
-    if (argc >= 2)
-        editor_open(argv[1]);
     editor_set_status_msg("Ctrl-S = save | Ctrl-Q = quit");
+    char err[256] = "";
+    editor_load_syntaxes(err, sizeof(err));
+    char *filename = NULL;
+    int view = 0;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-R"))
+            view = 1;
+        else
+            filename = argv[i];
+    }
+    if (filename && view)
+        editor_view(filename);
+    else if (filename)
+        editor_open(filename);
+    if (err[0])
+        editor_set_status_msg("syntax: %s", err);
     while (1) {
-        editor_clear_scrn();
+        editor_refresh();
+        editor_idle();
         editor_process_keypress();
     }
 }
@@ -1,16 +1,31 @@
+struct erow;
+
 void init();
 void die(const char *s);
 void disable_raw_mode();
 void enable_raw_mode();
  
+void editor_read_input(void *arg);
 int editor_read_key();
+int editor_input_pending();
 void editor_process_keypress();
 void editor_destroy();
 void editor_set_status_msg(const char *fmt, ...);
 void editor_move_cursor(int k);
+void editor_step_cursor(int n);
+void editor_move_rows(int n);
 char *editor_prompt(char *prompt, void (*)(char *, int));
+void editor_search_stop();
+void editor_search_invalidate();
+void editor_search_highlight(struct erow *row, int at, unsigned char *hl);
+void editor_save_reap();
  
+void editor_scroll();
 void editor_clear_scrn();
+void editor_refresh();
  
 int get_win_size(unsigned *rows, unsigned *cols);
+int editor_fit_window();
+void editor_relayout(void *arg);
+void editor_resize(void *arg);
 int get_cursor_position(unsigned *rows, unsigned *cols);
\ No newline at end of file
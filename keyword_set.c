@@ -0,0 +1,125 @@
+#include "keyword_set.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define KW_MAX_LEN 63         // longer words are never looked up
+#define KW_SEEDS_PER_SIZE 256 // seeds tried before the table is doubled
+
+struct kw_slot {
+    const char *word; // NULL for an empty slot
+    unsigned char len, tag;
+};
+struct kw_set {
+    struct kw_slot *slots;
+    uint32_t mask, seed;
+    uint64_t lens; // bit n is set when some word is n bytes long
+    char *text;    // the words, copied
+};
+
+static uint32_t kw_hash(uint32_t seed, const char *s, size_t len) {
+    uint32_t h = seed ^ (uint32_t)len * 0x9e3779b1u;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (unsigned char)s[i]) * 0x01000193u;
+    return h ^ h >> 15;
+}
+// places every word with this seed, failing on the first collision
+static int kw_place(kw_set *set, const char *const *words,
+                    const size_t *lens, const unsigned char *tags,
+                    unsigned n) {
+    memset(set->slots, 0, sizeof(struct kw_slot) * (set->mask + 1));
+    for (unsigned i = 0; i < n; i++) {
+        struct kw_slot *slot =
+            &set->slots[kw_hash(set->seed, words[i], lens[i]) & set->mask];
+        if (slot->word)
+            return -1;
+        *slot = (struct kw_slot){words[i], lens[i], tags[i]};
+    }
+    return 0;
+}
+/*
+ Words longer than KW_MAX_LEN and repeated words are left out. The table
+ starts at twice the number of words and doubles until a seed is found,
+ which for keyword lists takes a handful of tries. A hint from an earlier
+ build of the same words is tried first.
+*/
+kw_set *kw_build(const char *const *words, const size_t *lens,
+                 const unsigned char *tags, unsigned n,
+                 const struct kw_params *hint) {
+    kw_set *set = calloc(1, sizeof(kw_set));
+    if (!set)
+        abort();
+    const char **kept = malloc(sizeof(char *) * (n ? n : 1));
+    size_t *kept_lens = malloc(sizeof(size_t) * (n ? n : 1));
+    unsigned char *kept_tags = malloc(n ? n : 1);
+    size_t bytes = 0;
+    for (unsigned i = 0; i < n; i++)
+        bytes += lens[i];
+    set->text = malloc(bytes ? bytes : 1);
+    if (!kept || !kept_lens || !kept_tags || !set->text)
+        abort();
+    unsigned m = 0;
+    char *at = set->text;
+    for (unsigned i = 0; i < n; i++) {
+        if (lens[i] == 0 || lens[i] > KW_MAX_LEN)
+            continue;
+        unsigned j = 0;
+        while (j < m && !(kept_lens[j] == lens[i] &&
+                          !memcmp(kept[j], words[i], lens[i])))
+            j++;
+        if (j < m)
+            continue;
+        memcpy(at, words[i], lens[i]);
+        kept[m] = at;
+        kept_lens[m] = lens[i];
+        kept_tags[m++] = tags[i];
+        at += lens[i];
+        set->lens |= 1ull << lens[i];
+    }
+    unsigned size = 8;
+    while (size < 2 * m)
+        size *= 2;
+    if (hint && hint->size >= size && !(hint->size & (hint->size - 1))) {
+        set->mask = hint->size - 1;
+        set->seed = hint->seed;
+        set->slots = malloc(sizeof(struct kw_slot) * hint->size);
+        if (!set->slots)
+            abort();
+        if (kw_place(set, kept, kept_lens, kept_tags, m) == 0)
+            goto placed;
+    }
+    for (;; size *= 2) {
+        set->mask = size - 1;
+        set->slots = realloc(set->slots, sizeof(struct kw_slot) * size);
+        if (!set->slots)
+            abort();
+        for (set->seed = 1; set->seed <= KW_SEEDS_PER_SIZE; set->seed++)
+            if (kw_place(set, kept, kept_lens, kept_tags, m) == 0)
+                goto placed;
+    }
+placed:
+    free(kept);
+    free(kept_lens);
+    free(kept_tags);
+    return set;
+}
+void kw_params(const kw_set *set, struct kw_params *out) {
+    out->seed = set->seed;
+    out->size = set->mask + 1;
+}
+void kw_free(kw_set *set) {
+    if (!set)
+        return;
+    free(set->slots);
+    free(set->text);
+    free(set);
+}
+// the tag of the word equal to s[0..len), or 0
+int kw_lookup(const kw_set *set, const char *s, size_t len) {
+    if (len > KW_MAX_LEN || !(set->lens >> len & 1))
+        return 0;
+    const struct kw_slot *slot = &set->slots[kw_hash(set->seed, s, len) &
+                                              set->mask];
+    if (slot->len != len || memcmp(slot->word, s, len))
+        return 0;
+    return slot->tag;
+}
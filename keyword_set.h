@@ -0,0 +1,25 @@
+#ifndef KEYWORD_SET_H
+#define KEYWORD_SET_H
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ A fixed set of words, each with a small nonzero tag, looked up by a span
+ of text in O(1). kw_build() searches for a hash seed that gives every
+ word a slot of its own (a perfect hash), so a lookup is a length check,
+ one hash over the span and one memcmp, whatever the number of words.
+*/
+typedef struct kw_set kw_set;
+// what kw_build() found; handing it back to kw_build() skips the search
+struct kw_params {
+    uint32_t seed, size;
+};
+
+kw_set *kw_build(const char *const *words, const size_t *lens,
+                 const unsigned char *tags, unsigned n,
+                 const struct kw_params *hint);
+void kw_params(const kw_set *set, struct kw_params *out);
+void kw_free(kw_set *set);
+int kw_lookup(const kw_set *set, const char *s, size_t len);
+
+#endif
@@ -0,0 +1,180 @@
+#include "memscan.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MEMSCAN_X86 1
+#endif
+
+void memscan_init(struct memscan_index *idx, size_t stride) {
+    idx->offsets = NULL;
+    idx->noffsets = idx->cap = 0;
+    idx->stride = stride ? stride : 1;
+    idx->count = 0;
+}
+void memscan_free(struct memscan_index *idx) {
+    free(idx->offsets);
+    memscan_init(idx, idx->stride);
+}
+// counts one newline at `off`, keeping it if it ends a stride
+static void memscan_push(struct memscan_index *idx, size_t off) {
+    if (idx->count++ % idx->stride != idx->stride - 1)
+        return;
+    if (idx->noffsets == idx->cap) {
+        idx->cap = idx->cap ? idx->cap * 2 : 1024;
+        idx->offsets = realloc(idx->offsets, sizeof(size_t) * idx->cap);
+        if (!idx->offsets)
+            abort();
+    }
+    idx->offsets[idx->noffsets++] = off;
+}
+/*
+ Adds every '\n' of buf (which starts at file offset `base`) to the index.
+ 64 bytes are compared per iteration; when no checkpoint falls inside a block
+ its newlines are simply counted, otherwise the bitmask is walked with ctz.
+*/
+void memscan_newlines(struct memscan_index *idx, const char *buf, size_t len,
+                      size_t base) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (; i + 64 <= len; i += 64) {
+        const __m128i *p = (const __m128i *)(buf + i);
+        uint64_t mask =
+            (uint64_t)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(_mm_loadu_si128(p), nl)) |
+            (uint64_t)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(_mm_loadu_si128(p + 1), nl))
+                << 16 |
+            (uint64_t)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(_mm_loadu_si128(p + 2), nl))
+                << 32 |
+            (uint64_t)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(_mm_loadu_si128(p + 3), nl))
+                << 48;
+        size_t skip = idx->stride - 1 - idx->count % idx->stride;
+        if ((size_t)__builtin_popcountll(mask) <= skip) {
+            idx->count += __builtin_popcountll(mask);
+            continue;
+        }
+        while (mask) {
+            memscan_push(idx, base + i + __builtin_ctzll(mask));
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i < len; i++)
+        if (buf[i] == '\n')
+            memscan_push(idx, base + i);
+}
+size_t memscan_count_lines(const char *buf, size_t len) {
+    struct memscan_index idx;
+    memscan_init(&idx, SIZE_MAX);
+    memscan_newlines(&idx, buf, len, 0);
+    return idx.count;
+}
+
+/*
+ The vector kernels compare a block starting at i with the needle's first
+ byte and the block starting at i + nlen - 1 with its last byte. Only
+ positions where both agree are verified with memcmp, which rejects almost
+ everything in text without touching the middle of the needle.
+*/
+static void memscan_find_scalar(const char *hay, size_t len,
+                                const char *needle, size_t nlen, size_t i,
+                                memscan_match_fn match, void *arg) {
+    while (len - i >= nlen) {
+        const char *p = memchr(hay + i, needle[0], len - i - nlen + 1);
+        if (!p)
+            return;
+        i = p - hay;
+        if (!memcmp(p + 1, needle + 1, nlen - 1) && match(i, arg))
+            return;
+        i++;
+    }
+}
+#ifdef __SSE2__
+static void memscan_find_sse2(const char *hay, size_t len, const char *needle,
+                              size_t nlen, memscan_match_fn match, void *arg) {
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[nlen - 1]);
+    size_t i = 0;
+    for (; i + nlen - 1 + 16 <= len; i += 16) {
+        __m128i bf = _mm_loadu_si128((const __m128i *)(hay + i));
+        __m128i bl = _mm_loadu_si128((const __m128i *)(hay + i + nlen - 1));
+        unsigned mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(bf, first), _mm_cmpeq_epi8(bl, last)));
+        while (mask) {
+            size_t pos = i + __builtin_ctz(mask);
+            if ((nlen < 3 || !memcmp(hay + pos + 1, needle + 1, nlen - 2)) &&
+                match(pos, arg))
+                return;
+            mask &= mask - 1;
+        }
+    }
+    memscan_find_scalar(hay, len, needle, nlen, i, match, arg);
+}
+#endif
+#ifdef MEMSCAN_X86
+__attribute__((target("avx2"))) static void
+memscan_find_avx2(const char *hay, size_t len, const char *needle, size_t nlen,
+                  memscan_match_fn match, void *arg) {
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[nlen - 1]);
+    size_t i = 0;
+    for (; i + nlen - 1 + 32 <= len; i += 32) {
+        __m256i bf = _mm256_loadu_si256((const __m256i *)(hay + i));
+        __m256i bl = _mm256_loadu_si256((const __m256i *)(hay + i + nlen - 1));
+        unsigned mask = _mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(bf, first), _mm256_cmpeq_epi8(bl, last)));
+        while (mask) {
+            size_t pos = i + __builtin_ctz(mask);
+            if ((nlen < 3 || !memcmp(hay + pos + 1, needle + 1, nlen - 2)) &&
+                match(pos, arg))
+                return;
+            mask &= mask - 1;
+        }
+    }
+    memscan_find_scalar(hay, len, needle, nlen, i, match, arg);
+}
+#endif
+static void memscan_find_generic(const char *hay, size_t len,
+                                 const char *needle, size_t nlen,
+                                 memscan_match_fn match, void *arg) {
+    memscan_find_scalar(hay, len, needle, nlen, 0, match, arg);
+}
+
+static void (*memscan_find_impl)(const char *, size_t, const char *, size_t,
+                                 memscan_match_fn, void *) =
+    memscan_find_generic;
+// picks the widest kernel the running CPU supports, once at startup
+__attribute__((constructor)) static void memscan_dispatch(void) {
+#ifdef __SSE2__
+    memscan_find_impl = memscan_find_sse2;
+#endif
+#ifdef MEMSCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        memscan_find_impl = memscan_find_avx2;
+#endif
+}
+void memscan_find(const char *hay, size_t len, const char *needle,
+                  size_t nlen, memscan_match_fn match, void *arg) {
+    if (nlen == 0 || nlen > len)
+        return;
+    memscan_find_impl(hay, len, needle, nlen, match, arg);
+}
+static int memscan_first(size_t off, void *arg) {
+    *(size_t *)arg = off;
+    return 1;
+}
+const char *memscan_memmem(const char *hay, size_t len, const char *needle,
+                           size_t nlen) {
+    size_t off = SIZE_MAX;
+    memscan_find(hay, len, needle, nlen, memscan_first, &off);
+    return off == SIZE_MAX ? NULL : hay + off;
+}
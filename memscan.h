@@ -0,0 +1,33 @@
+#ifndef MEMSCAN_H
+#define MEMSCAN_H
+#include <stddef.h>
+
+/*
+ Line index built by memscan_newlines(). With stride 1 every newline offset
+ is kept; a larger stride keeps only every stride-th one as a checkpoint.
+*/
+struct memscan_index {
+    size_t *offsets;
+    size_t noffsets;
+    size_t cap;
+    size_t stride;
+    size_t count; // newlines seen so far
+};
+
+void memscan_init(struct memscan_index *idx, size_t stride);
+void memscan_free(struct memscan_index *idx);
+void memscan_newlines(struct memscan_index *idx, const char *buf, size_t len,
+                      size_t base);
+size_t memscan_count_lines(const char *buf, size_t len);
+
+/*
+ Substring search. memscan_find() reports the offset of every occurrence of
+ needle in hay (overlapping ones included) until `match` returns nonzero.
+*/
+typedef int (*memscan_match_fn)(size_t off, void *arg);
+void memscan_find(const char *hay, size_t len, const char *needle,
+                  size_t nlen, memscan_match_fn match, void *arg);
+const char *memscan_memmem(const char *hay, size_t len, const char *needle,
+                           size_t nlen);
+
+#endif
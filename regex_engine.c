@@ -0,0 +1,734 @@
+#include "regex_engine.h"
+#include "memscan.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define RX_MAX_INSTS 20000  // compiled program size limit
+#define RX_MAX_REPEAT 1000  // largest count allowed in {m,n}
+#define RX_DFA_STATES 1024  // DFA states kept before the cache is flushed
+#define RX_DFA_FLUSHES 8    // flushes tolerated before falling back to NFA
+#define RX_CACHE_SIZE 16    // compiled patterns kept by rx_cached()
+
+enum { RX_LIT, RX_CAT, RX_ALT, RX_REP, RX_BOL, RX_EOL, RX_EMPTY };
+struct rx_node {
+    int type;
+    int a, b;     // children
+    int min, max; // RX_REP bounds, max -1 when unbounded
+    int cls;      // RX_LIT byte class
+};
+enum { RX_OP_CLASS, RX_OP_SPLIT, RX_OP_JMP, RX_OP_BOL, RX_OP_EOL, RX_OP_MATCH };
+struct rx_inst {
+    int op;
+    int x, y; // successors; y only for RX_OP_SPLIT
+    int cls;
+};
+struct rx_prog {
+    struct rx_inst *code;
+    int ncode, capcode;
+    unsigned char (*cls)[32]; // byte classes as 256-bit sets
+    int ncls;
+    char *prefix; // literal every match starts with
+    size_t nprefix;
+    unsigned char first[256]; // bytes a match not at column 0 can start with
+    int anchored;             // matches can only start at column 0
+    int refs;
+};
+
+struct rx_dstate {
+    int next[256]; // -1 until computed
+    size_t set;    // NFA states, as an offset into the matcher's pool
+    int n;
+    unsigned hash;
+    int hnext;
+    unsigned char match, match_eol;
+};
+struct rx_matcher {
+    rx_prog *prog;
+    struct rx_dstate *states;
+    int nstates, cap;
+    int *pool;
+    size_t npool, poolcap;
+    int buckets[RX_DFA_STATES * 2];
+    int start[2]; // DFA states at column 0 and elsewhere, -1 when unknown
+    unsigned epoch; // bumped by every flush
+    int flushes;
+    int nfa_only;
+    unsigned *mark; // closure visit marks, stamped with gen
+    unsigned gen;
+    int *stack, *set, *set2;
+};
+
+static void *rx_alloc(void *p, size_t n) {
+    p = realloc(p, n);
+    if (!p)
+        abort();
+    return p;
+}
+static int rx_has(unsigned char *cls, unsigned char c) {
+    return cls[c >> 3] & (1 << (c & 7));
+}
+static void rx_add(unsigned char *cls, unsigned char c) {
+    cls[c >> 3] |= 1 << (c & 7);
+}
+
+/*** parser ***/
+struct rx_parser {
+    const char *p;
+    const char *err;
+    struct rx_node *nodes;
+    int n, cap;
+    rx_prog *prog;
+};
+static int rx_node(struct rx_parser *ps, int type, int a, int b) {
+    if (ps->n == ps->cap) {
+        ps->cap = ps->cap ? ps->cap * 2 : 32;
+        ps->nodes = rx_alloc(ps->nodes, sizeof(struct rx_node) * ps->cap);
+    }
+    ps->nodes[ps->n] = (struct rx_node){type, a, b, 0, 0, -1};
+    return ps->n++;
+}
+static int rx_new_class(struct rx_parser *ps) {
+    rx_prog *prog = ps->prog;
+    prog->cls = rx_alloc(prog->cls, 32 * (prog->ncls + 1));
+    memset(prog->cls[prog->ncls], 0, 32);
+    return prog->ncls++;
+}
+// fills cls for \d \w \s and their upper case negations
+static int rx_escape_class(unsigned char *cls, char e) {
+    int neg = e == 'D' || e == 'W' || e == 'S';
+    unsigned char set[32] = {0};
+    for (int c = 0; c < 256; c++) {
+        int in = 0;
+        switch (e | 0x20) {
+        case 'd':
+            in = c >= '0' && c <= '9';
+            break;
+        case 'w':
+            in = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+                 (c >= 'A' && c <= 'Z') || c == '_';
+            break;
+        case 's':
+            in = c == ' ' || (c >= '\t' && c <= '\r');
+            break;
+        default:
+            return 0;
+        }
+        if (in != neg)
+            rx_add(set, c);
+    }
+    for (int i = 0; i < 32; i++)
+        cls[i] |= set[i];
+    return 1;
+}
+static char rx_escape_char(char e) {
+    switch (e) {
+    case 't':
+        return '\t';
+    case 'n':
+        return '\n';
+    case 'r':
+        return '\r';
+    }
+    return e;
+}
+static int rx_parse_class(struct rx_parser *ps) {
+    int cls = rx_new_class(ps);
+    unsigned char set[32] = {0};
+    int neg = 0;
+    if (*ps->p == '^') {
+        neg = 1;
+        ps->p++;
+    }
+    for (int first = 1; first || *ps->p != ']'; first = 0) {
+        if (!*ps->p) {
+            ps->err = "missing ]";
+            return -1;
+        }
+        unsigned char lo = *ps->p++;
+        if (lo == '\\') {
+            if (!*ps->p) {
+                ps->err = "trailing \\";
+                return -1;
+            }
+            if (rx_escape_class(set, *ps->p)) {
+                ps->p++;
+                continue;
+            }
+            lo = rx_escape_char(*ps->p++);
+        }
+        unsigned char hi = lo;
+        if (ps->p[0] == '-' && ps->p[1] && ps->p[1] != ']') {
+            hi = ps->p[1];
+            ps->p += 2;
+            if (hi == '\\' && *ps->p)
+                hi = rx_escape_char(*ps->p++);
+            if (hi < lo) {
+                ps->err = "bad range";
+                return -1;
+            }
+        }
+        for (int c = lo; c <= hi; c++)
+            rx_add(set, c);
+    }
+    ps->p++;
+    for (int i = 0; i < 32; i++)
+        ps->prog->cls[cls][i] = neg ? ~set[i] : set[i];
+    return cls;
+}
+static int rx_parse_alt(struct rx_parser *ps);
+static int rx_parse_atom(struct rx_parser *ps) {
+    char c = *ps->p++;
+    int n, cls;
+    switch (c) {
+    case '(':
+        n = rx_parse_alt(ps);
+        if (n < 0)
+            return -1;
+        if (*ps->p != ')') {
+            ps->err = "missing )";
+            return -1;
+        }
+        ps->p++;
+        return n;
+    case '^':
+        return rx_node(ps, RX_BOL, -1, -1);
+    case '$':
+        return rx_node(ps, RX_EOL, -1, -1);
+    case '[':
+        if ((cls = rx_parse_class(ps)) < 0)
+            return -1;
+        break;
+    case '.':
+        cls = rx_new_class(ps);
+        memset(ps->prog->cls[cls], 0xff, 32);
+        break;
+    case '*':
+    case '+':
+    case '?':
+    case '{':
+        ps->err = "nothing to repeat";
+        return -1;
+    case '\\':
+        if (!*ps->p) {
+            ps->err = "trailing \\";
+            return -1;
+        }
+        cls = rx_new_class(ps);
+        if (!rx_escape_class(ps->prog->cls[cls], *ps->p))
+            rx_add(ps->prog->cls[cls], rx_escape_char(*ps->p));
+        ps->p++;
+        break;
+    default:
+        cls = rx_new_class(ps);
+        rx_add(ps->prog->cls[cls], c);
+        break;
+    }
+    n = rx_node(ps, RX_LIT, -1, -1);
+    ps->nodes[n].cls = cls;
+    return n;
+}
+static int rx_parse_count(struct rx_parser *ps) {
+    int n = 0;
+    if (*ps->p < '0' || *ps->p > '9')
+        return -1;
+    while (*ps->p >= '0' && *ps->p <= '9' && n <= RX_MAX_REPEAT)
+        n = n * 10 + (*ps->p++ - '0');
+    return n;
+}
+static int rx_parse_repeat(struct rx_parser *ps) {
+    int n = rx_parse_atom(ps);
+    while (n >= 0 && *ps->p && strchr("*+?{", *ps->p)) {
+        int min = 0, max = -1;
+        char c = *ps->p++;
+        if (c == '+')
+            min = 1;
+        else if (c == '?')
+            max = 1;
+        else if (c == '{') {
+            min = max = rx_parse_count(ps);
+            if (*ps->p == ',') {
+                ps->p++;
+                max = *ps->p == '}' ? -1 : rx_parse_count(ps);
+            }
+            if (min < 0 || *ps->p != '}' || min > RX_MAX_REPEAT ||
+                max > RX_MAX_REPEAT || (max != -1 && max < min)) {
+                ps->err = "bad repetition";
+                return -1;
+            }
+            ps->p++;
+        }
+        int r = rx_node(ps, RX_REP, n, -1);
+        ps->nodes[r].min = min;
+        ps->nodes[r].max = max;
+        n = r;
+    }
+    return n;
+}
+static int rx_parse_cat(struct rx_parser *ps) {
+    int n = rx_node(ps, RX_EMPTY, -1, -1);
+    while (*ps->p && *ps->p != '|' && *ps->p != ')') {
+        int r = rx_parse_repeat(ps);
+        if (r < 0)
+            return -1;
+        n = rx_node(ps, RX_CAT, n, r);
+    }
+    return n;
+}
+static int rx_parse_alt(struct rx_parser *ps) {
+    int n = rx_parse_cat(ps);
+    while (n >= 0 && *ps->p == '|') {
+        ps->p++;
+        int r = rx_parse_cat(ps);
+        if (r < 0)
+            return -1;
+        n = rx_node(ps, RX_ALT, n, r);
+    }
+    return n;
+}
+
+/*** compiler ***/
+static int rx_emit(rx_prog *prog, int op, int x, int y, int cls) {
+    if (prog->ncode == RX_MAX_INSTS)
+        return -1;
+    if (prog->ncode == prog->capcode) {
+        prog->capcode = prog->capcode ? prog->capcode * 2 : 16;
+        prog->code =
+            rx_alloc(prog->code, sizeof(struct rx_inst) * prog->capcode);
+    }
+    prog->code[prog->ncode] = (struct rx_inst){op, x, y, cls};
+    return prog->ncode++;
+}
+// emits code for node n falling through to the next instruction
+static int rx_gen(rx_prog *prog, struct rx_node *nodes, int n) {
+    struct rx_node *nd = &nodes[n];
+    int pc, i;
+    switch (nd->type) {
+    case RX_EMPTY:
+        return 0;
+    case RX_LIT:
+        return rx_emit(prog, RX_OP_CLASS, prog->ncode + 1, 0, nd->cls) < 0;
+    case RX_BOL:
+    case RX_EOL:
+        return rx_emit(prog, nd->type == RX_BOL ? RX_OP_BOL : RX_OP_EOL,
+                       prog->ncode + 1, 0, 0) < 0;
+    case RX_CAT:
+        return rx_gen(prog, nodes, nd->a) || rx_gen(prog, nodes, nd->b);
+    case RX_ALT: {
+        int split = rx_emit(prog, RX_OP_SPLIT, prog->ncode + 1, 0, 0);
+        if (split < 0 || rx_gen(prog, nodes, nd->a))
+            return 1;
+        int jmp = rx_emit(prog, RX_OP_JMP, 0, 0, 0);
+        if (jmp < 0)
+            return 1;
+        prog->code[split].y = prog->ncode;
+        if (rx_gen(prog, nodes, nd->b))
+            return 1;
+        prog->code[jmp].x = prog->ncode;
+        return 0;
+    }
+    case RX_REP:
+        for (i = 0; i < nd->min; i++)
+            if (rx_gen(prog, nodes, nd->a))
+                return 1;
+        if (nd->max == -1) {
+            // L: split body, out; body; jmp L
+            pc = rx_emit(prog, RX_OP_SPLIT, prog->ncode + 1, 0, 0);
+            if (pc < 0 || rx_gen(prog, nodes, nd->a) ||
+                rx_emit(prog, RX_OP_JMP, pc, 0, 0) < 0)
+                return 1;
+            prog->code[pc].y = prog->ncode;
+            return 0;
+        }
+        for (; i < nd->max; i++) {
+            pc = rx_emit(prog, RX_OP_SPLIT, prog->ncode + 1, 0, 0);
+            if (pc < 0 || rx_gen(prog, nodes, nd->a))
+                return 1;
+            prog->code[pc].y = prog->ncode;
+        }
+        return 0;
+    }
+    return 1;
+}
+// the literal that starts every match, read off the leftmost concatenation
+static void rx_find_prefix(rx_prog *prog, struct rx_node *nodes, int n,
+                           char *buf, size_t *len, int *stop) {
+    struct rx_node *nd = &nodes[n];
+    if (*stop)
+        return;
+    if (nd->type == RX_CAT) {
+        rx_find_prefix(prog, nodes, nd->a, buf, len, stop);
+        rx_find_prefix(prog, nodes, nd->b, buf, len, stop);
+        return;
+    }
+    if (nd->type == RX_EMPTY)
+        return;
+    if (nd->type == RX_REP && nd->min >= 1) {
+        rx_find_prefix(prog, nodes, nd->a, buf, len, stop);
+        *stop = 1;
+        return;
+    }
+    int c = -1;
+    if (nd->type == RX_LIT) {
+        for (int i = 0; i < 256; i++) {
+            if (!rx_has(prog->cls[nd->cls], i))
+                continue;
+            if (c != -1) {
+                c = -1;
+                break;
+            }
+            c = i;
+        }
+    }
+    if (c == -1 || *len == 255) {
+        *stop = 1;
+        return;
+    }
+    buf[(*len)++] = c;
+}
+static long rx_run(rx_matcher *m, const char *s, size_t len, size_t pos);
+static void rx_closure(rx_matcher *m, int pc, int bol, int eol, int *set,
+                       int *n);
+
+rx_prog *rx_compile(const char *pattern, const char **err) {
+    rx_prog *prog = calloc(1, sizeof(rx_prog));
+    if (!prog)
+        abort();
+    prog->refs = 1;
+    struct rx_parser ps = {pattern, NULL, NULL, 0, 0, prog};
+    int root = rx_parse_alt(&ps);
+    if (root >= 0 && *ps.p == ')')
+        ps.err = "unmatched )";
+    if (!ps.err && (rx_gen(prog, ps.nodes, root) ||
+                    rx_emit(prog, RX_OP_MATCH, 0, 0, 0) < 0))
+        ps.err = "pattern too large";
+    if (ps.err) {
+        free(ps.nodes);
+        *err = ps.err;
+        rx_release(prog);
+        return NULL;
+    }
+    char buf[256];
+    int stop = 0;
+    rx_find_prefix(prog, ps.nodes, root, buf, &prog->nprefix, &stop);
+    prog->prefix = rx_alloc(NULL, prog->nprefix + 1);
+    memcpy(prog->prefix, buf, prog->nprefix);
+    free(ps.nodes);
+
+    // what can start a match anywhere but column 0
+    rx_matcher *m = rx_matcher_new(prog);
+    int n = 0;
+    m->gen++;
+    rx_closure(m, 0, 0, 0, m->set, &n);
+    prog->anchored = 1;
+    for (int i = 0; i < n; i++) {
+        struct rx_inst *in = &prog->code[m->set[i]];
+        if (in->op != RX_OP_CLASS)
+            continue;
+        prog->anchored = 0;
+        for (int c = 0; c < 256; c++)
+            prog->first[c] |= rx_has(prog->cls[in->cls], c);
+    }
+    rx_matcher_free(m);
+    *err = NULL;
+    return prog;
+}
+// reference counting is not atomic: only the UI thread may call these
+void rx_retain(rx_prog *prog) { prog->refs++; }
+void rx_release(rx_prog *prog) {
+    if (!prog || --prog->refs)
+        return;
+    free(prog->code);
+    free(prog->cls);
+    free(prog->prefix);
+    free(prog);
+}
+/*
+ Compiles through a small cache, so retyping or deleting back to an earlier
+ pattern in the search prompt does not compile it again. The returned
+ program is retained for the caller.
+*/
+rx_prog *rx_cached(const char *pattern, const char **err) {
+    static struct {
+        char *pattern;
+        rx_prog *prog;
+    } cache[RX_CACHE_SIZE];
+    static unsigned next;
+    for (int i = 0; i < RX_CACHE_SIZE; i++) {
+        if (cache[i].pattern && !strcmp(cache[i].pattern, pattern)) {
+            rx_retain(cache[i].prog);
+            *err = NULL;
+            return cache[i].prog;
+        }
+    }
+    rx_prog *prog = rx_compile(pattern, err);
+    if (!prog)
+        return NULL;
+    unsigned i = next++ % RX_CACHE_SIZE;
+    free(cache[i].pattern);
+    rx_release(cache[i].prog);
+    cache[i].pattern = strdup(pattern);
+    cache[i].prog = prog;
+    rx_retain(prog);
+    return prog;
+}
+const char *rx_prefix(rx_prog *prog, size_t *len) {
+    *len = prog->nprefix;
+    return prog->prefix;
+}
+
+/*** matcher ***/
+rx_matcher *rx_matcher_new(rx_prog *prog) {
+    rx_matcher *m = calloc(1, sizeof(rx_matcher));
+    if (!m)
+        abort();
+    m->prog = prog;
+    m->mark = rx_alloc(NULL, sizeof(unsigned) * prog->ncode);
+    memset(m->mark, 0, sizeof(unsigned) * prog->ncode);
+    m->stack = rx_alloc(NULL, sizeof(int) * prog->ncode);
+    m->set = rx_alloc(NULL, sizeof(int) * prog->ncode);
+    m->set2 = rx_alloc(NULL, sizeof(int) * prog->ncode);
+    memset(m->buckets, -1, sizeof(m->buckets));
+    m->start[0] = m->start[1] = -1;
+    return m;
+}
+void rx_matcher_free(rx_matcher *m) {
+    free(m->states);
+    free(m->pool);
+    free(m->mark);
+    free(m->stack);
+    free(m->set);
+    free(m->set2);
+    free(m);
+}
+/*
+ Adds the states reachable from pc without reading a byte to set. Only the
+ states that matter after the closure are kept: byte classes, the match and
+ "$" when eol is not known yet. A state is pushed at most once per m->gen,
+ which bounds both the stack and the set by the program size.
+*/
+#define RX_PUSH(pc)                                                            \
+    do {                                                                       \
+        if (m->mark[pc] != m->gen) {                                           \
+            m->mark[pc] = m->gen;                                              \
+            m->stack[sp++] = (pc);                                             \
+        }                                                                      \
+    } while (0)
+static void rx_closure(rx_matcher *m, int pc, int bol, int eol, int *set,
+                       int *n) {
+    struct rx_inst *code = m->prog->code;
+    int sp = 0;
+    RX_PUSH(pc);
+    while (sp) {
+        pc = m->stack[--sp];
+        struct rx_inst *in = &code[pc];
+        switch (in->op) {
+        case RX_OP_SPLIT:
+            RX_PUSH(in->y);
+            RX_PUSH(in->x);
+            break;
+        case RX_OP_JMP:
+            RX_PUSH(in->x);
+            break;
+        case RX_OP_BOL:
+            if (bol)
+                RX_PUSH(in->x);
+            break;
+        case RX_OP_EOL:
+            if (eol)
+                RX_PUSH(in->x);
+            else
+                set[(*n)++] = pc;
+            break;
+        default:
+            set[(*n)++] = pc;
+            break;
+        }
+    }
+}
+// whether set holds the match, and whether it does once "$" is satisfied
+static void rx_set_flags(rx_matcher *m, int *set, int n, unsigned char *match,
+                         unsigned char *match_eol) {
+    struct rx_inst *code = m->prog->code;
+    *match = *match_eol = 0;
+    for (int i = 0; i < n; i++)
+        if (code[set[i]].op == RX_OP_MATCH)
+            *match = *match_eol = 1;
+    if (*match)
+        return;
+    int k = 0;
+    m->gen++;
+    for (int i = 0; i < n; i++)
+        if (code[set[i]].op == RX_OP_EOL)
+            rx_closure(m, code[set[i]].x, 0, 1, m->set2, &k);
+    for (int i = 0; i < k; i++)
+        if (code[m->set2[i]].op == RX_OP_MATCH)
+            *match_eol = 1;
+}
+static int rx_cmp_int(const void *a, const void *b) {
+    return *(const int *)a - *(const int *)b;
+}
+static void rx_flush(rx_matcher *m) {
+    m->nstates = 0;
+    m->npool = 0;
+    memset(m->buckets, -1, sizeof(m->buckets));
+    m->start[0] = m->start[1] = -1;
+    m->epoch++;
+    if (++m->flushes > RX_DFA_FLUSHES)
+        m->nfa_only = 1;
+}
+// the DFA state for a set of NFA states, created on first use
+static int rx_dstate(rx_matcher *m, int *set, int n) {
+    qsort(set, n, sizeof(int), rx_cmp_int);
+    unsigned h = 2166136261u;
+    for (int i = 0; i < n; i++)
+        h = (h ^ set[i]) * 16777619u;
+    int *b = &m->buckets[h % (RX_DFA_STATES * 2)];
+    for (int s = *b; s != -1; s = m->states[s].hnext) {
+        struct rx_dstate *d = &m->states[s];
+        if (d->hash == h && d->n == n &&
+            !memcmp(m->pool + d->set, set, sizeof(int) * n))
+            return s;
+    }
+    if (m->nstates == RX_DFA_STATES) {
+        rx_flush(m);
+        b = &m->buckets[h % (RX_DFA_STATES * 2)];
+    }
+    if (m->nstates == m->cap) {
+        m->cap = m->cap ? m->cap * 2 : 16;
+        m->states = rx_alloc(m->states, sizeof(struct rx_dstate) * m->cap);
+    }
+    if (m->npool + n > m->poolcap) {
+        m->poolcap = (m->npool + n) * 2;
+        m->pool = rx_alloc(m->pool, sizeof(int) * m->poolcap);
+    }
+    int s = m->nstates++;
+    struct rx_dstate *d = &m->states[s];
+    memset(d->next, -1, sizeof(d->next));
+    memcpy(m->pool + m->npool, set, sizeof(int) * n);
+    d->set = m->npool;
+    d->n = n;
+    m->npool += n;
+    d->hash = h;
+    d->hnext = *b;
+    *b = s;
+    rx_set_flags(m, set, n, &d->match, &d->match_eol);
+    return s;
+}
+static int rx_start(rx_matcher *m, int bol) {
+    if (m->start[bol] == -1) {
+        int n = 0;
+        m->gen++;
+        rx_closure(m, 0, bol, 0, m->set, &n);
+        m->start[bol] = rx_dstate(m, m->set, n);
+    }
+    return m->start[bol];
+}
+// follows the states of set on byte c into m->set
+static int rx_follow(rx_matcher *m, const int *set, int n, unsigned char c) {
+    rx_prog *prog = m->prog;
+    int k = 0;
+    m->gen++;
+    for (int i = 0; i < n; i++) {
+        struct rx_inst *in = &prog->code[set[i]];
+        if (in->op == RX_OP_CLASS && rx_has(prog->cls[in->cls], c))
+            rx_closure(m, in->x, 0, 0, m->set, &k);
+    }
+    return k;
+}
+static int rx_step(rx_matcher *m, int s, unsigned char c) {
+    int t = m->states[s].next[c];
+    if (t != -1)
+        return t;
+    unsigned epoch = m->epoch;
+    int k = rx_follow(m, m->pool + m->states[s].set, m->states[s].n, c);
+    t = rx_dstate(m, m->set, k);
+    if (epoch == m->epoch) // s is gone if the cache was flushed meanwhile
+        m->states[s].next[c] = t;
+    return t;
+}
+// NFA simulation, used once the DFA keeps blowing its cache
+static long rx_nfa_longest(rx_matcher *m, const char *s, size_t len,
+                           size_t pos) {
+    size_t ncode = m->prog->ncode;
+    int *cur = rx_alloc(NULL, sizeof(int) * ncode), n = 0;
+    long last = -1;
+    unsigned char match, match_eol;
+    m->gen++;
+    rx_closure(m, 0, pos == 0, 0, cur, &n);
+    size_t i = pos;
+    for (;; i++) {
+        rx_set_flags(m, cur, n, &match, &match_eol);
+        if (match)
+            last = i;
+        if (i == len || !n)
+            break;
+        n = rx_follow(m, cur, n, s[i]);
+        memcpy(cur, m->set, sizeof(int) * n);
+    }
+    if (i == len && match_eol)
+        last = len;
+    free(cur);
+    return last;
+}
+static long rx_run(rx_matcher *m, const char *s, size_t len, size_t pos) {
+    if (m->nfa_only)
+        return rx_nfa_longest(m, s, len, pos);
+    int st = rx_start(m, pos == 0);
+    long last = m->states[st].match ? (long)pos : -1;
+    size_t i = pos;
+    for (; i < len; i++) {
+        st = rx_step(m, st, s[i]);
+        if (!m->states[st].n)
+            return last;
+        if (m->states[st].match)
+            last = i + 1;
+    }
+    if (m->states[st].match_eol)
+        last = len;
+    return last;
+}
+// end of the longest match starting at pos, or -1
+long rx_longest(rx_matcher *m, const char *s, size_t len, size_t pos) {
+    return rx_run(m, s, len, pos);
+}
+/*
+ Leftmost-longest non-empty match at or after from. Start positions are
+ skipped with the literal prefix (through memscan) when the pattern has one,
+ and with the set of possible first bytes otherwise.
+*/
+long rx_search(rx_matcher *m, const char *s, size_t len, size_t from,
+               size_t *mlen) {
+    rx_prog *prog = m->prog;
+    size_t pos = from;
+    if (pos == 0) {
+        long end = rx_run(m, s, len, 0);
+        if (end > 0) {
+            *mlen = end;
+            return 0;
+        }
+        pos = 1;
+    }
+    if (prog->anchored)
+        return -1;
+    while (pos < len) {
+        if (prog->nprefix) {
+            const char *p =
+                memscan_memmem(s + pos, len - pos, prog->prefix, prog->nprefix);
+            if (!p)
+                return -1;
+            pos = p - s;
+        } else {
+            while (pos < len && !prog->first[(unsigned char)s[pos]])
+                pos++;
+            if (pos == len)
+                return -1;
+        }
+        long end = rx_run(m, s, len, pos);
+        if (end > (long)pos) {
+            *mlen = end - pos;
+            return pos;
+        }
+        pos++;
+    }
+    return -1;
+}
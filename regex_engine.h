@@ -0,0 +1,34 @@
+#ifndef REGEX_ENGINE_H
+#define REGEX_ENGINE_H
+#include <stddef.h>
+
+/*
+ Small regular expression engine for search. Supported syntax: literals,
+ ".", "[a-z]", "[^...]", "\d \w \s" (and their negations), "^", "$", "|",
+ "(...)", "*", "+", "?" and "{m}", "{m,}", "{m,n}". Matching is
+ leftmost-longest and line based: "^" and "$" match at the ends of the
+ buffer given to rx_search().
+
+ A pattern compiles to a Thompson NFA (rx_prog, read-only once built, so it
+ can be shared by threads). Each thread matches through its own rx_matcher,
+ which turns the NFA into a DFA lazily, one state per new set of NFA states
+ met. When the DFA outgrows its cache it is flushed, and a matcher that
+ keeps flushing falls back to simulating the NFA directly, which is slower
+ but bounded by O(text * pattern).
+*/
+typedef struct rx_prog rx_prog;
+typedef struct rx_matcher rx_matcher;
+
+rx_prog *rx_compile(const char *pattern, const char **err);
+void rx_retain(rx_prog *prog);
+void rx_release(rx_prog *prog);
+rx_prog *rx_cached(const char *pattern, const char **err);
+const char *rx_prefix(rx_prog *prog, size_t *len);
+
+rx_matcher *rx_matcher_new(rx_prog *prog);
+void rx_matcher_free(rx_matcher *m);
+long rx_longest(rx_matcher *m, const char *s, size_t len, size_t pos);
+long rx_search(rx_matcher *m, const char *s, size_t len, size_t from,
+               size_t *mlen);
+
+#endif
@@ -0,0 +1,114 @@
+#include "row_arena.h"
+#include <stdlib.h>
+
+#define RA_MAX_SIZE ((size_t)1 << (RA_MIN_SHIFT + RA_CLASSES - 1))
+#define RA_PAGE ((size_t)4096) // large allocations are rounded to pages
+
+struct ra_large {
+    struct ra_large *prev, *next;
+    size_t size;
+    size_t pad; // keeps the payload 16-byte aligned, like malloc()
+};
+
+static int ra_class(size_t size) {
+    int c = 0;
+    while (((size_t)1 << (RA_MIN_SHIFT + c)) < size)
+        c++;
+    return c;
+}
+static void *ra_carve(row_arena *ra, size_t slot) {
+    if (ra->left < slot) {
+        // the rest of the old block is too small for this class, so it is
+        // handed to the free lists of the classes it still fits
+        while (ra->left >= ((size_t)1 << RA_MIN_SHIFT)) {
+            int c = ra_class(ra->left);
+            if (((size_t)1 << (RA_MIN_SHIFT + c)) > ra->left)
+                c--;
+            size_t n = (size_t)1 << (RA_MIN_SHIFT + c);
+            *(void **)ra->next = ra->free[c];
+            ra->free[c] = ra->next;
+            ra->next += n;
+            ra->left -= n;
+        }
+        void **block = malloc(RA_BLOCK);
+        if (!block)
+            abort();
+        *block = ra->blocks;
+        ra->blocks = block;
+        ra->reserved += RA_BLOCK;
+        // the link takes the first slot of the smallest class
+        ra->next = (char *)block + ((size_t)1 << RA_MIN_SHIFT);
+        ra->left = RA_BLOCK - ((size_t)1 << RA_MIN_SHIFT);
+    }
+    void *p = ra->next;
+    ra->next += slot;
+    ra->left -= slot;
+    return p;
+}
+// returns at least size bytes, and in *cap how many can be used
+void *ra_alloc(row_arena *ra, size_t size, size_t *cap) {
+    if (size > RA_MAX_SIZE) {
+        // a long line still grows a keystroke at a time, so it gets half
+        // again as much room, in whole pages, instead of a copy per byte
+        size = (size + size / 2 + RA_PAGE - 1) & ~(RA_PAGE - 1);
+        struct ra_large *l = malloc(sizeof(struct ra_large) + size);
+        if (!l)
+            abort();
+        *l = (struct ra_large){NULL, ra->large, size, 0};
+        if (ra->large)
+            ra->large->prev = l;
+        ra->large = l;
+        ra->used += size;
+        ra->reserved += size;
+        if (cap)
+            *cap = size;
+        return l + 1;
+    }
+    int c = ra_class(size);
+    size_t slot = (size_t)1 << (RA_MIN_SHIFT + c);
+    void *p = ra->free[c];
+    if (p)
+        ra->free[c] = *(void **)p;
+    else
+        p = ra_carve(ra, slot);
+    ra->used += slot;
+    if (cap)
+        *cap = slot;
+    return p;
+}
+// size is what was asked of ra_alloc(), or the capacity it reported
+void ra_free(row_arena *ra, void *p, size_t size) {
+    if (!p)
+        return;
+    if (size > RA_MAX_SIZE) {
+        struct ra_large *l = (struct ra_large *)p - 1;
+        if (l->prev)
+            l->prev->next = l->next;
+        else
+            ra->large = l->next;
+        if (l->next)
+            l->next->prev = l->prev;
+        ra->used -= l->size;
+        ra->reserved -= l->size;
+        free(l);
+        return;
+    }
+    int c = ra_class(size);
+    *(void **)p = ra->free[c];
+    ra->free[c] = p;
+    ra->used -= (size_t)1 << (RA_MIN_SHIFT + c);
+}
+// frees everything ever allocated from ra, leaving it empty and usable
+void ra_release(row_arena *ra) {
+    while (ra->blocks) {
+        void *next = *(void **)ra->blocks;
+        free(ra->blocks);
+        ra->blocks = next;
+    }
+    while (ra->large) {
+        struct ra_large *next = ra->large->next;
+        free(ra->large);
+        ra->large = next;
+    }
+    *ra = (row_arena){{NULL}};
+}
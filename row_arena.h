@@ -0,0 +1,35 @@
+#ifndef ROW_ARENA_H
+#define ROW_ARENA_H
+#include <stddef.h>
+
+#define RA_MIN_SHIFT 4   // smallest size class, 16 bytes
+#define RA_CLASSES 13    // up to 64 KB, anything larger is malloc()ed
+                         // with half again its size to grow into
+#define RA_BLOCK (1 << 20) // bytes carved into slots at a time
+
+/*
+ Allocator for the per-row payloads of one buffer: chars, highlight spans
+ and tab indexes. Sizes are rounded up to a power of two, so a row has
+ room to grow before it moves, and freed slots go on a free list of their
+ class for the next row of that size. Slots are carved out of large blocks,
+ which is what keeps millions of small rows from fragmenting the heap, and
+ the whole buffer is given back at once by ra_release() instead of row by
+ row. Callers pass the size back to ra_free(); slots carry no header.
+*/
+struct ra_large;
+typedef struct row_arena {
+    void *free[RA_CLASSES]; // free slots of each class, linked through
+                            // their first bytes
+    char *next;             // unused part of the newest block
+    size_t left;
+    void *blocks;           // every block, linked through its first bytes
+    struct ra_large *large; // allocations above the largest class
+    size_t used;            // bytes in live slots and large allocations
+    size_t reserved;        // bytes taken from malloc()
+} row_arena;
+
+void *ra_alloc(row_arena *ra, size_t size, size_t *cap);
+void ra_free(row_arena *ra, void *p, size_t size);
+void ra_release(row_arena *ra);
+
+#endif
@@ -0,0 +1,177 @@
+#include "save_worker.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define SV_IOV 1024            // pieces of rows handed to one writev()
+#define SV_PUBLISH_EVERY 65536 // rows between two progress notifications
+
+static struct {
+    pthread_mutex_t lock;
+    int notify[2]; // a byte is written on progress and when a job finishes
+} sv = {PTHREAD_MUTEX_INITIALIZER, {-1, -1}};
+
+struct sv_batch {
+    sv_job *job;
+    int fd;
+    int err; // errno of the first failure, 0 while all is well
+    int n;
+    size_t bytes;
+    struct iovec iov[SV_IOV];
+};
+
+static void sv_publish(sv_job *job, unsigned done, int finished) {
+    pthread_mutex_lock(&sv.lock);
+    job->done = done;
+    job->finished = finished;
+    pthread_mutex_unlock(&sv.lock);
+    char c = 0;
+    if (write(sv.notify[1], &c, 1) == -1) {
+        // the pipe is full, so the UI is already going to wake up
+    }
+}
+// writes all of iov, picking up where a short writev() left off
+static int sv_writev_all(int fd, struct iovec *iov, int n) {
+    while (n > 0) {
+        ssize_t w = writev(fd, iov, n);
+        if (w == -1 && errno == EINTR)
+            continue;
+        if (w == -1)
+            return -1;
+        while (n > 0 && (size_t)w >= iov->iov_len) {
+            w -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char *)iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
+    return 0;
+}
+static int sv_flush(struct sv_batch *b) {
+    if (sv_writev_all(b->fd, b->iov, b->n) == -1)
+        b->err = errno;
+    b->n = 0;
+    return b->err;
+}
+// queues the row and its newline, writing out a batch whenever one fills up
+static int sv_row(erow *row, unsigned at, void *arg) {
+    struct sv_batch *b = arg;
+    if (b->n + 2 > SV_IOV && sv_flush(b))
+        return 1;
+    if (row->size)
+        b->iov[b->n++] = (struct iovec){row->chars, row->size};
+    b->iov[b->n++] = (struct iovec){"\n", 1};
+    b->bytes += row->size + 1;
+    if ((at + 1) % SV_PUBLISH_EVERY == 0)
+        sv_publish(b->job, at + 1, 0);
+    return 0;
+}
+// returns 0, or the errno that left the target untouched
+static int sv_write(sv_job *job) {
+    const char *slash = strrchr(job->target, '/');
+    int dirlen = slash ? slash - job->target + 1 : 0;
+    char tmp[PATH_MAX];
+    if (snprintf(tmp, sizeof(tmp), "%.*s.%s.iexot-XXXXXX", dirlen,
+                 job->target, job->target + dirlen) >= (int)sizeof(tmp))
+        return ENAMETOOLONG;
+    int fd = mkstemp(tmp);
+    if (fd == -1)
+        return errno;
+    struct sv_batch *b = calloc(1, sizeof(struct sv_batch));
+    if (!b)
+        abort();
+    b->job = job;
+    b->fd = fd;
+    if (fchmod(fd, job->mode) == -1)
+        b->err = errno;
+    if (!b->err)
+        ts_for_range(&job->rows, 0, job->nrows, sv_row, b);
+    if (!b->err)
+        sv_flush(b);
+    if (!b->err && fsync(fd) == -1)
+        b->err = errno;
+    if (close(fd) == -1 && !b->err)
+        b->err = errno;
+    if (!b->err && rename(tmp, job->target) == -1)
+        b->err = errno;
+    int err = b->err;
+    job->bytes = b->bytes;
+    free(b);
+    if (err) {
+        unlink(tmp);
+        return err;
+    }
+    // the rename is only durable once the directory is synced too
+    tmp[dirlen] = '\0';
+    int dfd = open(dirlen ? tmp : ".", O_RDONLY | O_DIRECTORY);
+    if (dfd != -1) {
+        fsync(dfd);
+        close(dfd);
+    }
+    return 0;
+}
+static void *sv_worker(void *arg) {
+    sv_job *job = arg;
+    job->err = sv_write(job);
+    sv_publish(job, job->nrows, 1);
+    return NULL;
+}
+/*
+ Starts writing rows to target, taking ownership of the rows struct. The
+ mode is looked up here rather than on the thread, as the umask can only be
+ read by changing it.
+*/
+sv_job *sv_submit(text_store *rows, const char *target) {
+    if (sv.notify[0] == -1) {
+        if (pipe(sv.notify) == -1)
+            abort();
+        fcntl(sv.notify[0], F_SETFL, O_NONBLOCK);
+        fcntl(sv.notify[1], F_SETFL, O_NONBLOCK);
+    }
+    sv_job *job = calloc(1, sizeof(sv_job));
+    if (!job || !(job->target = strdup(target)))
+        abort();
+    job->rows = *rows;
+    job->nrows = ts_nrows(rows);
+    struct stat st;
+    if (stat(target, &st) == 0) {
+        job->mode = st.st_mode & 07777;
+    } else {
+        mode_t mask = umask(0);
+        umask(mask);
+        job->mode = 0644 & ~mask;
+    }
+    if (pthread_create(&job->thread, NULL, sv_worker, job) != 0)
+        abort();
+    return job;
+}
+// rows written so far into *done; returns 1 once the job is finished
+int sv_progress(sv_job *job, unsigned *done) {
+    pthread_mutex_lock(&sv.lock);
+    int finished = job->finished;
+    if (done)
+        *done = job->done;
+    pthread_mutex_unlock(&sv.lock);
+    return finished;
+}
+// waits for the job to finish, so a save is never left half done
+void sv_free(sv_job *job) {
+    pthread_join(job->thread, NULL);
+    free(job->target);
+    free(job);
+}
+int sv_notify_fd() { return sv.notify[0]; }
+void sv_drain_notify() {
+    char buf[64];
+    while (sv.notify[0] != -1 && read(sv.notify[0], buf, sizeof(buf)) > 0)
+        ;
+}
@@ -0,0 +1,33 @@
+#ifndef SAVE_WORKER_H
+#define SAVE_WORKER_H
+#include "text_store.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ Writes rows to a file on a thread of its own. The rows are streamed with
+ writev() into a temporary file next to the target, which is fsync()ed and
+ renamed over it, so a crash or a full disk leaves either the old file or
+ the new one and never a truncated mix. The rows must not change until the
+ job is finished, which is what a ts_snapshot() of the buffer is for.
+*/
+typedef struct sv_job {
+    text_store rows; // owned by the caller, who releases it after sv_free()
+    char *target;
+    mode_t mode;     // the target's permissions, kept by the new file
+    unsigned nrows;
+    unsigned done;   // rows written, read with sv_progress()
+    size_t bytes;
+    int err;         // errno of the failure; the target is then untouched
+    int finished;
+    pthread_t thread;
+} sv_job;
+
+sv_job *sv_submit(text_store *rows, const char *target);
+int sv_progress(sv_job *job, unsigned *done);
+void sv_free(sv_job *job);
+int sv_notify_fd();
+void sv_drain_notify();
+
+#endif
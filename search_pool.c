@@ -0,0 +1,155 @@
+#include "search_pool.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SP_MAX_WORKERS 64
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work; // a job with unhanded chunks was submitted
+    pthread_cond_t idle; // a job's last running chunk finished
+    sp_job *job;
+    int nworkers;
+    int notify[2]; // a byte is written for every finished chunk
+} sp = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+        PTHREAD_COND_INITIALIZER, NULL, 0, {-1, -1}};
+
+void sp_push(struct sp_matches *m, unsigned row, unsigned col, unsigned len) {
+    if (m->n == m->cap) {
+        m->cap = m->cap ? m->cap * 2 : 16;
+        m->v = realloc(m->v, sizeof(struct sp_match) * m->cap);
+        if (!m->v)
+            abort();
+    }
+    m->v[m->n++] = (struct sp_match){row, col, len};
+}
+// index of the first match at or after (row, col)
+unsigned sp_lower_bound(struct sp_matches *m, unsigned row, unsigned col) {
+    unsigned lo = 0, hi = m->n;
+    while (lo < hi) {
+        unsigned mid = (lo + hi) / 2;
+        struct sp_match *x = &m->v[mid];
+        if (x->row < row || (x->row == row && x->col < col))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+static void *sp_worker(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&sp.lock);
+    while (1) {
+        sp_job *job = sp.job;
+        if (!job || job->handed == job->nchunks) {
+            pthread_cond_wait(&sp.work, &sp.lock);
+            continue;
+        }
+        unsigned chunk = (job->first_chunk + job->handed++) % job->nchunks;
+        job->running++;
+        pthread_mutex_unlock(&sp.lock);
+
+        struct sp_chunk out = {{NULL, 0, 0}, 1};
+        job->scan(job, chunk, &out);
+
+        pthread_mutex_lock(&sp.lock);
+        if (sp_cancelled(job))
+            free(out.m.v);
+        else
+            job->chunks[chunk] = out;
+        if (--job->running == 0)
+            pthread_cond_broadcast(&sp.idle);
+        char c = 0;
+        if (write(sp.notify[1], &c, 1) == -1) {
+            // the pipe is full, so the UI is already going to wake up
+        }
+    }
+    return NULL;
+}
+static void sp_start_workers() {
+    if (sp.nworkers)
+        return;
+    if (pipe(sp.notify) == -1)
+        abort();
+    fcntl(sp.notify[0], F_SETFL, O_NONBLOCK);
+    fcntl(sp.notify[1], F_SETFL, O_NONBLOCK);
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1)
+        n = 1;
+    if (n > SP_MAX_WORKERS)
+        n = SP_MAX_WORKERS;
+    for (; sp.nworkers < n; sp.nworkers++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, sp_worker, NULL) != 0)
+            break;
+        pthread_detach(tid);
+    }
+    if (!sp.nworkers)
+        abort();
+}
+
+sp_job *sp_submit(const char *pattern, size_t plen, rx_prog *prog,
+                  unsigned nrows, unsigned chunk_rows, unsigned first_chunk,
+                  sp_scan_fn scan, void *src) {
+    sp_start_workers();
+    sp_job *job = calloc(1, sizeof(sp_job));
+    if (!job)
+        abort();
+    job->pattern = malloc(plen + 1);
+    memcpy(job->pattern, pattern, plen + 1);
+    job->plen = plen;
+    job->prog = prog;
+    job->nrows = nrows;
+    job->chunk_rows = chunk_rows;
+    job->nchunks = (nrows + chunk_rows - 1) / chunk_rows;
+    job->first_chunk = job->nchunks ? first_chunk % job->nchunks : 0;
+    job->scan = scan;
+    job->src = src;
+    job->chunks = calloc(job->nchunks ? job->nchunks : 1,
+                         sizeof(struct sp_chunk));
+    if (!job->pattern || !job->chunks)
+        abort();
+    pthread_mutex_lock(&sp.lock);
+    sp.job = job;
+    pthread_cond_broadcast(&sp.work);
+    pthread_mutex_unlock(&sp.lock);
+    return job;
+}
+int sp_chunk_done(sp_job *job, unsigned chunk) {
+    pthread_mutex_lock(&sp.lock);
+    int done = job->chunks[chunk].done;
+    pthread_mutex_unlock(&sp.lock);
+    return done;
+}
+// polled by scan functions, which run without the pool's lock
+int sp_cancelled(sp_job *job) {
+    return __atomic_load_n(&job->cancelled, __ATOMIC_RELAXED);
+}
+// stops handing out chunks and waits until no worker reads the source
+void sp_cancel(sp_job *job) {
+    pthread_mutex_lock(&sp.lock);
+    __atomic_store_n(&job->cancelled, 1, __ATOMIC_RELAXED);
+    job->handed = job->nchunks;
+    while (job->running)
+        pthread_cond_wait(&sp.idle, &sp.lock);
+    if (sp.job == job)
+        sp.job = NULL;
+    pthread_mutex_unlock(&sp.lock);
+}
+void sp_free(sp_job *job) {
+    sp_cancel(job);
+    for (unsigned i = 0; i < job->nchunks; i++)
+        free(job->chunks[i].m.v);
+    free(job->chunks);
+    free(job->pattern);
+    free(job);
+}
+int sp_notify_fd() { return sp.notify[0]; }
+void sp_drain_notify() {
+    char buf[64];
+    while (sp.notify[0] != -1 && read(sp.notify[0], buf, sizeof(buf)) > 0)
+        ;
+}
@@ -0,0 +1,52 @@
+#ifndef SEARCH_POOL_H
+#define SEARCH_POOL_H
+#include "regex_engine.h"
+#include <stddef.h>
+
+/*
+ Worker pool for whole-file search. A job splits the rows into fixed-size
+ chunks; workers take chunks starting from `first_chunk` (the one holding
+ the cursor) and wrapping around, and publish each chunk's matches as soon
+ as it is scanned. Only one job runs at a time.
+*/
+struct sp_match {
+    unsigned row, col, len;
+};
+// matches ordered by row, then column
+struct sp_matches {
+    struct sp_match *v;
+    unsigned n, cap;
+};
+struct sp_chunk {
+    struct sp_matches m;
+    int done;
+};
+struct sp_job;
+typedef void (*sp_scan_fn)(struct sp_job *job, unsigned chunk,
+                           struct sp_chunk *out);
+typedef struct sp_job {
+    char *pattern;
+    size_t plen;
+    rx_prog *prog; // compiled pattern of a regex search, borrowed
+    unsigned nrows, chunk_rows, nchunks, first_chunk;
+    sp_scan_fn scan;
+    void *src;
+    struct sp_chunk *chunks;
+    unsigned handed; // chunks given to workers so far
+    int running;     // chunks being scanned right now
+    int cancelled; // read with sp_cancelled()
+} sp_job;
+
+sp_job *sp_submit(const char *pattern, size_t plen, rx_prog *prog,
+                  unsigned nrows, unsigned chunk_rows, unsigned first_chunk,
+                  sp_scan_fn scan, void *src);
+int sp_chunk_done(sp_job *job, unsigned chunk);
+void sp_cancel(sp_job *job);
+int sp_cancelled(sp_job *job);
+void sp_free(sp_job *job);
+void sp_push(struct sp_matches *m, unsigned row, unsigned col, unsigned len);
+unsigned sp_lower_bound(struct sp_matches *m, unsigned row, unsigned col);
+int sp_notify_fd();
+void sp_drain_notify();
+
+#endif
@@ -0,0 +1,529 @@
+#include "syntax_db.h"
+#include <dirent.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SDB_CACHE_MAGIC "iexotsyn"
+#define SDB_CACHE_VERSION 1
+#define SDB_MAX_FILES 256 // definition files looked at in one directory
+
+struct sdb_file {
+    char *name;
+    int64_t mtime_sec, mtime_nsec, size;
+};
+
+static void *sdb_alloc(size_t n) {
+    void *p = calloc(1, n ? n : 1);
+    if (!p)
+        abort();
+    return p;
+}
+static char *sdb_strndup(const char *s, size_t len) {
+    char *p = sdb_alloc(len + 1);
+    memcpy(p, s, len);
+    return p;
+}
+// appends to a NULL-terminated array of strings
+static void sdb_push(char ***list, char *s) {
+    size_t n = 0;
+    while (*list && (*list)[n])
+        n++;
+    *list = realloc(*list, sizeof(char *) * (n + 2));
+    if (!*list)
+        abort();
+    (*list)[n] = s;
+    (*list)[n + 1] = NULL;
+}
+static void sdb_free_list(char **list) {
+    for (size_t i = 0; list && list[i]; i++)
+        free(list[i]);
+    free(list);
+}
+static void sdb_free_syntax(struct editor_syntax *s) {
+    free(s->filetype);
+    sdb_free_list(s->filematch);
+    sdb_free_list(s->shebangs);
+    sdb_free_list(s->keywords);
+    free(s->singleline_comment_start);
+    free(s->multiline_comment_start);
+    free(s->multiline_comment_end);
+    free(s->quotes);
+    kw_free(s->kw);
+}
+static void sdb_error(char *err, size_t errlen, const char *fmt, ...) {
+    if (!err || !errlen || err[0])
+        return; // only the first error is kept
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(err, errlen, fmt, ap);
+    va_end(ap);
+}
+
+/*** compiling ***/
+
+// keywords ending in '|' are datatypes
+static kw_set *sdb_build_keywords(char **keywords,
+                                  const struct kw_params *hint) {
+    unsigned n = 0;
+    while (keywords && keywords[n])
+        n++;
+    size_t *lens = sdb_alloc(sizeof(size_t) * n);
+    unsigned char *tags = sdb_alloc(n);
+    for (unsigned i = 0; i < n; i++) {
+        lens[i] = strlen(keywords[i]);
+        tags[i] = HL_KEYWORD;
+        if (lens[i] && keywords[i][lens[i] - 1] == '|') {
+            lens[i]--;
+            tags[i] = HL_DATATYPE;
+        }
+    }
+    kw_set *kw = kw_build((const char *const *)keywords, lens, tags, n, hint);
+    free(lens);
+    free(tags);
+    return kw;
+}
+static void sdb_compile_hinted(struct editor_syntax *s,
+                               const struct kw_params *hint) {
+    if (s->compiled)
+        return;
+    s->scs_len = s->singleline_comment_start
+                     ? strlen(s->singleline_comment_start)
+                     : 0;
+    s->mcs_len = s->multiline_comment_start
+                     ? strlen(s->multiline_comment_start)
+                     : 0;
+    s->mce_len =
+        s->multiline_comment_end ? strlen(s->multiline_comment_end) : 0;
+    memset(s->lex, 0, sizeof(s->lex));
+    if (s->scs_len)
+        s->lex[(unsigned char)s->singleline_comment_start[0]] |=
+            LEX_LINE_COMMENT;
+    if (s->mcs_len && s->mce_len) {
+        s->lex[(unsigned char)s->multiline_comment_start[0]] |=
+            LEX_BLOCK_OPEN;
+        s->lex[(unsigned char)s->multiline_comment_end[0]] |= LEX_BLOCK_CLOSE;
+    } else {
+        s->mcs_len = s->mce_len = 0;
+    }
+    if ((s->flags & HL_HIGHLIGHT_STRINGS) && s->quotes)
+        for (const char *q = s->quotes; *q; q++)
+            s->lex[(unsigned char)*q] |= LEX_QUOTE;
+    s->kw = sdb_build_keywords(s->keywords, hint);
+    s->compiled = 1;
+}
+/*
+ Builds the tables the highlighter runs on, once per definition: the first
+ byte of every delimiter is marked in lex[] so that most bytes are dismissed
+ with one load, and the keywords go into a perfect hash.
+*/
+void sdb_compile(struct editor_syntax *s) {
+    sdb_compile_hinted(s, NULL);
+}
+
+/*** parsing ***/
+
+static char *sdb_token(char **p, size_t *len) {
+    char *s = *p;
+    while (*s == ' ' || *s == '\t')
+        s++;
+    char *e = s;
+    while (*e && *e != ' ' && *e != '\t')
+        e++;
+    *p = e;
+    *len = e - s;
+    return *len ? s : NULL;
+}
+static void sdb_words(char ***list, char *rest, const char *suffix) {
+    char *w;
+    size_t len, slen = strlen(suffix);
+    while ((w = sdb_token(&rest, &len))) {
+        char *word = sdb_alloc(len + slen + 1);
+        memcpy(word, w, len);
+        memcpy(word + len, suffix, slen);
+        sdb_push(list, word);
+    }
+}
+static char *sdb_one(char **rest) {
+    size_t len;
+    char *w = sdb_token(rest, &len);
+    return w ? sdb_strndup(w, len) : NULL;
+}
+// parses one definition file, appending its syntaxes to *db
+static void sdb_parse(const char *path, struct editor_syntax **db,
+                      unsigned *n, char *err, size_t errlen) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        sdb_error(err, errlen, "%s: cannot open", path);
+        return;
+    }
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t linelen;
+    unsigned lineno = 0;
+    struct editor_syntax *cur = NULL;
+    while ((linelen = getline(&line, &cap, fp)) != -1) {
+        lineno++;
+        while (linelen > 0 &&
+               (line[linelen - 1] == '\n' || line[linelen - 1] == '\r'))
+            line[--linelen] = '\0';
+        char *rest = line;
+        size_t len;
+        char *dir = sdb_token(&rest, &len);
+        if (!dir || dir[0] == '#')
+            continue;
+        if (*rest)
+            *rest++ = '\0';
+        if (!strcmp(dir, "syntax")) {
+            char *name = sdb_one(&rest);
+            if (!name) {
+                sdb_error(err, errlen, "%s:%u: syntax needs a name", path,
+                          lineno);
+                cur = NULL;
+                continue;
+            }
+            *db = realloc(*db, sizeof(struct editor_syntax) * (*n + 1));
+            if (!*db)
+                abort();
+            cur = &(*db)[(*n)++];
+            memset(cur, 0, sizeof(*cur));
+            cur->filetype = name;
+            continue;
+        }
+        if (!cur) {
+            sdb_error(err, errlen, "%s:%u: '%s' outside a syntax section",
+                      path, lineno, dir);
+            continue;
+        }
+        if (!strcmp(dir, "extensions")) {
+            sdb_words(&cur->filematch, rest, "");
+        } else if (!strcmp(dir, "shebang")) {
+            sdb_words(&cur->shebangs, rest, "");
+        } else if (!strcmp(dir, "keywords")) {
+            sdb_words(&cur->keywords, rest, "");
+        } else if (!strcmp(dir, "types")) {
+            sdb_words(&cur->keywords, rest, "|");
+        } else if (!strcmp(dir, "comment")) {
+            free(cur->singleline_comment_start);
+            cur->singleline_comment_start = sdb_one(&rest);
+        } else if (!strcmp(dir, "block_comment")) {
+            free(cur->multiline_comment_start);
+            free(cur->multiline_comment_end);
+            cur->multiline_comment_start = sdb_one(&rest);
+            cur->multiline_comment_end = sdb_one(&rest);
+            if (!cur->multiline_comment_end)
+                sdb_error(err, errlen, "%s:%u: block_comment needs an end",
+                          path, lineno);
+        } else if (!strcmp(dir, "strings")) {
+            free(cur->quotes);
+            cur->quotes = sdb_one(&rest);
+            cur->flags |= HL_HIGHLIGHT_STRINGS;
+        } else if (!strcmp(dir, "numbers")) {
+            cur->flags |= HL_HIGHLIGHT_NUMBERS;
+        } else {
+            sdb_error(err, errlen, "%s:%u: unknown directive '%s'", path,
+                      lineno, dir);
+        }
+    }
+    free(line);
+    fclose(fp);
+}
+
+/*** cache ***/
+
+static void sdb_put(FILE *fp, const void *p, size_t len) {
+    fwrite(p, 1, len, fp);
+}
+static void sdb_put_u32(FILE *fp, uint32_t v) {
+    sdb_put(fp, &v, sizeof(v));
+}
+static void sdb_put_str(FILE *fp, const char *s) {
+    sdb_put_u32(fp, s ? strlen(s) : UINT32_MAX);
+    if (s)
+        sdb_put(fp, s, strlen(s));
+}
+static void sdb_put_list(FILE *fp, char **list) {
+    uint32_t n = 0;
+    while (list && list[n])
+        n++;
+    sdb_put_u32(fp, n);
+    for (uint32_t i = 0; i < n; i++)
+        sdb_put_str(fp, list[i]);
+}
+static int sdb_get(FILE *fp, void *p, size_t len) {
+    return fread(p, 1, len, fp) == len ? 0 : -1;
+}
+static int sdb_get_u32(FILE *fp, uint32_t *v) {
+    return sdb_get(fp, v, sizeof(*v));
+}
+static int sdb_get_str(FILE *fp, char **s) {
+    uint32_t len;
+    *s = NULL;
+    if (sdb_get_u32(fp, &len) == -1)
+        return -1;
+    if (len == UINT32_MAX)
+        return 0;
+    if (len > 1 << 20)
+        return -1;
+    *s = sdb_alloc(len + 1);
+    return sdb_get(fp, *s, len);
+}
+static int sdb_get_list(FILE *fp, char ***list) {
+    uint32_t n;
+    *list = NULL;
+    if (sdb_get_u32(fp, &n) == -1 || n > 1 << 16)
+        return -1;
+    for (uint32_t i = 0; i < n; i++) {
+        char *s;
+        if (sdb_get_str(fp, &s) == -1 || !s) {
+            free(s);
+            return -1;
+        }
+        sdb_push(list, s);
+    }
+    return 0;
+}
+// creates the directories leading to path
+static void sdb_mkdirs(const char *path) {
+    char *p = sdb_strndup(path, strlen(path));
+    for (char *s = strchr(p + 1, '/'); s; s = strchr(s + 1, '/')) {
+        *s = '\0';
+        mkdir(p, 0755);
+        *s = '/';
+    }
+    free(p);
+}
+/*
+ The cache is written to a temporary file and renamed over the old one, so
+ an editor starting at the same time reads either cache whole.
+*/
+static void sdb_write_cache(const char *cache, struct sdb_file *files,
+                            unsigned nfiles, struct editor_syntax *db,
+                            unsigned n) {
+    sdb_mkdirs(cache);
+    size_t len = strlen(cache) + 32;
+    char *tmp = sdb_alloc(len);
+    snprintf(tmp, len, "%s.%ld", cache, (long)getpid());
+    FILE *fp = fopen(tmp, "wb");
+    if (!fp) {
+        free(tmp);
+        return;
+    }
+    sdb_put(fp, SDB_CACHE_MAGIC, 8);
+    sdb_put_u32(fp, SDB_CACHE_VERSION);
+    sdb_put_u32(fp, nfiles);
+    for (unsigned i = 0; i < nfiles; i++) {
+        sdb_put_str(fp, files[i].name);
+        sdb_put(fp, &files[i].mtime_sec, sizeof(int64_t) * 3);
+    }
+    sdb_put_u32(fp, n);
+    for (unsigned i = 0; i < n; i++) {
+        struct editor_syntax *s = &db[i];
+        struct kw_params kp;
+        kw_params(s->kw, &kp);
+        sdb_put_str(fp, s->filetype);
+        sdb_put_list(fp, s->filematch);
+        sdb_put_list(fp, s->shebangs);
+        sdb_put_list(fp, s->keywords);
+        sdb_put_str(fp, s->singleline_comment_start);
+        sdb_put_str(fp, s->multiline_comment_start);
+        sdb_put_str(fp, s->multiline_comment_end);
+        sdb_put_str(fp, s->quotes);
+        sdb_put_u32(fp, s->flags);
+        sdb_put(fp, s->lex, sizeof(s->lex));
+        sdb_put_u32(fp, kp.seed);
+        sdb_put_u32(fp, kp.size);
+    }
+    if (fclose(fp) == 0)
+        rename(tmp, cache);
+    unlink(tmp);
+    free(tmp);
+}
+/*
+ Returns the cached syntaxes when the cache was built from exactly these
+ definition files, NULL otherwise. Tables come back as they were written;
+ only the keyword hash is rebuilt, with the seed found back then.
+*/
+static struct editor_syntax *sdb_read_cache(const char *cache,
+                                            struct sdb_file *files,
+                                            unsigned nfiles, unsigned *n) {
+    FILE *fp = fopen(cache, "rb");
+    if (!fp)
+        return NULL;
+    struct editor_syntax *db = NULL;
+    uint32_t version, count, nsyn = 0, i = 0;
+    char magic[8];
+    if (sdb_get(fp, magic, 8) == -1 || memcmp(magic, SDB_CACHE_MAGIC, 8) ||
+        sdb_get_u32(fp, &version) == -1 || version != SDB_CACHE_VERSION ||
+        sdb_get_u32(fp, &count) == -1 || count != nfiles)
+        goto stale;
+    for (uint32_t f = 0; f < count; f++) {
+        char *name;
+        int64_t stamp[3];
+        if (sdb_get_str(fp, &name) == -1 || !name) {
+            free(name);
+            goto stale;
+        }
+        int same = !strcmp(name, files[f].name);
+        free(name);
+        if (!same || sdb_get(fp, stamp, sizeof(stamp)) == -1 ||
+            memcmp(stamp, &files[f].mtime_sec, sizeof(stamp)))
+            goto stale;
+    }
+    if (sdb_get_u32(fp, &nsyn) == -1 || nsyn > SDB_MAX_FILES * 16)
+        goto stale;
+    db = sdb_alloc(sizeof(struct editor_syntax) * nsyn);
+    for (; i < nsyn; i++) {
+        struct editor_syntax *s = &db[i];
+        uint32_t flags;
+        struct kw_params kp;
+        if (sdb_get_str(fp, &s->filetype) == -1 ||
+            sdb_get_list(fp, &s->filematch) == -1 ||
+            sdb_get_list(fp, &s->shebangs) == -1 ||
+            sdb_get_list(fp, &s->keywords) == -1 ||
+            sdb_get_str(fp, &s->singleline_comment_start) == -1 ||
+            sdb_get_str(fp, &s->multiline_comment_start) == -1 ||
+            sdb_get_str(fp, &s->multiline_comment_end) == -1 ||
+            sdb_get_str(fp, &s->quotes) == -1 ||
+            sdb_get_u32(fp, &flags) == -1 ||
+            sdb_get(fp, s->lex, sizeof(s->lex)) == -1 ||
+            sdb_get_u32(fp, &kp.seed) == -1 ||
+            sdb_get_u32(fp, &kp.size) == -1) {
+            i++; // the partly read entry is freed too
+            goto stale;
+        }
+        s->flags = flags;
+        unsigned char lex[256];
+        memcpy(lex, s->lex, sizeof(lex));
+        sdb_compile_hinted(s, &kp);
+        memcpy(s->lex, lex, sizeof(lex));
+    }
+    fclose(fp);
+    *n = nsyn;
+    return db;
+stale:
+    for (uint32_t j = 0; j < i; j++)
+        sdb_free_syntax(&db[j]);
+    free(db);
+    fclose(fp);
+    return NULL;
+}
+
+/*** loading ***/
+
+static int sdb_file_cmp(const void *a, const void *b) {
+    return strcmp(((const struct sdb_file *)a)->name,
+                  ((const struct sdb_file *)b)->name);
+}
+/*
+ Loads every "*.syn" file of dir, in name order, through the cache when it
+ is still valid. A missing directory is not an error; the first problem in
+ the definitions is described in err, and such definitions are not cached
+ so the problem is reported again on the next start.
+*/
+struct editor_syntax *sdb_load(const char *dir, const char *cache,
+                               unsigned *n, char *err, size_t errlen) {
+    *n = 0;
+    if (err && errlen)
+        err[0] = '\0';
+    DIR *d = opendir(dir);
+    if (!d)
+        return NULL;
+    struct sdb_file files[SDB_MAX_FILES];
+    unsigned nfiles = 0;
+    size_t dirlen = strlen(dir);
+    struct dirent *de;
+    while ((de = readdir(d)) && nfiles < SDB_MAX_FILES) {
+        size_t len = strlen(de->d_name);
+        if (len < 5 || strcmp(de->d_name + len - 4, ".syn"))
+            continue;
+        char *path = sdb_alloc(dirlen + len + 2);
+        snprintf(path, dirlen + len + 2, "%s/%s", dir, de->d_name);
+        struct stat st;
+        if (stat(path, &st) == -1 || !S_ISREG(st.st_mode)) {
+            free(path);
+            continue;
+        }
+        files[nfiles++] = (struct sdb_file){path, st.st_mtim.tv_sec,
+                                            st.st_mtim.tv_nsec, st.st_size};
+    }
+    closedir(d);
+    qsort(files, nfiles, sizeof(files[0]), sdb_file_cmp);
+
+    struct editor_syntax *db =
+        cache ? sdb_read_cache(cache, files, nfiles, n) : NULL;
+    if (!db) {
+        for (unsigned i = 0; i < nfiles; i++)
+            sdb_parse(files[i].name, &db, n, err, errlen);
+        for (unsigned i = 0; i < *n; i++)
+            sdb_compile(&db[i]);
+        if (cache && (!err || !err[0]))
+            sdb_write_cache(cache, files, nfiles, db, *n);
+    }
+    for (unsigned i = 0; i < nfiles; i++)
+        free(files[i].name);
+    return db;
+}
+
+/*** selecting ***/
+
+// "python" names python, python3 and python3.12 alike
+static int sdb_interpreter_is(const char *name, size_t len,
+                              const char *want) {
+    size_t wlen = strlen(want);
+    if (len < wlen || memcmp(name, want, wlen))
+        return 0;
+    for (size_t i = wlen; i < len; i++)
+        if (!((name[i] >= '0' && name[i] <= '9') || name[i] == '.'))
+            return 0;
+    return 1;
+}
+/*
+ Whether s applies to the file: by its name first, then by the interpreter
+ a "#!" first line names, looking through "/usr/bin/env [-S] name".
+*/
+int sdb_matches(struct editor_syntax *s, const char *filename,
+                const char *line, size_t len) {
+    if (filename) {
+        const char *ext = strrchr(filename, '.');
+        for (size_t i = 0; s->filematch && s->filematch[i]; i++) {
+            int is_ext = (s->filematch[i][0] == '.');
+            if ((is_ext && ext && !strcmp(ext, s->filematch[i])) ||
+                (!is_ext && strstr(filename, s->filematch[i])))
+                return 1;
+        }
+    }
+    if (!s->shebangs || !line || len < 2 || line[0] != '#' || line[1] != '!')
+        return 0;
+    const char *p = line + 2, *end = line + len;
+    const char *name = NULL;
+    size_t namelen = 0;
+    for (int env = 0; p < end;) {
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p++;
+        const char *w = p;
+        while (p < end && *p != ' ' && *p != '\t' && *p != '\r')
+            p++;
+        if (p == w)
+            break;
+        if (env && (*w == '-' || memchr(w, '=', p - w)))
+            continue; // env options and assignments
+        name = w;
+        for (const char *q = w; q < p; q++)
+            if (*q == '/')
+                name = q + 1;
+        namelen = p - name;
+        if (env || namelen != 3 || memcmp(name, "env", 3))
+            break;
+        env = 1;
+        name = NULL;
+    }
+    for (size_t i = 0; name && s->shebangs[i]; i++)
+        if (sdb_interpreter_is(name, namelen, s->shebangs[i]))
+            return 1;
+    return 0;
+}
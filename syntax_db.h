@@ -0,0 +1,71 @@
+#ifndef SYNTAX_DB_H
+#define SYNTAX_DB_H
+#include "keyword_set.h"
+#include <stddef.h>
+
+#define HL_HIGHLIGHT_NUMBERS (1 << 0)
+#define HL_HIGHLIGHT_STRINGS (1 << 1)
+
+enum EDITOR_HIGHLIGHT {
+    HL_NORMAL = 0,
+    HL_NUMBER,
+    HL_MATCH,
+    HL_STRING,
+    HL_COMMENT,
+    HL_KEYWORD,
+    HL_DATATYPE
+};
+// what a byte may start, in editor_syntax.lex
+enum LEX_CLASS {
+    LEX_LINE_COMMENT = 1,
+    LEX_BLOCK_OPEN = 2,
+    LEX_BLOCK_CLOSE = 4,
+    LEX_QUOTE = 8
+};
+
+struct editor_syntax {
+    char *filetype;
+    char **filematch; // ".ext" is an extension, anything else a substring
+    char **shebangs;  // interpreters named on a "#!" first line
+    char **keywords;  // datatypes end in '|'
+    char *singleline_comment_start;
+    char *multiline_comment_start;
+    char *multiline_comment_end;
+    char *quotes; // characters that open a string
+    int flags;
+
+    // filled in by sdb_compile()
+    int compiled;
+    int scs_len, mcs_len, mce_len;
+    unsigned char lex[256]; // LEX_CLASS bits of every byte
+    kw_set *kw;             // keywords by span
+};
+
+/*
+ Syntax definitions are plain text files, "*.syn", in one directory:
+
+     syntax python
+     extensions .py .pyw
+     shebang python python3
+     keywords def class if elif else while for in return import from
+     types int str float bool
+     comment #
+     strings "'
+     numbers
+
+ Lines starting with '#' are comments, "block_comment {- -}" names block
+ comment delimiters, and several "syntax" sections may share a file.
+
+ Each definition is compiled into lookup tables: a byte class table telling
+ the highlighter which bytes can open a comment or a string, and a perfect
+ hash of the keywords. Compiled definitions are written to a cache file,
+ kept as long as the name, size and mtime of every definition file match,
+ so a normal start reads the cache instead of parsing the definitions.
+*/
+void sdb_compile(struct editor_syntax *s);
+struct editor_syntax *sdb_load(const char *dir, const char *cache,
+                               unsigned *n, char *err, size_t errlen);
+int sdb_matches(struct editor_syntax *s, const char *filename,
+                const char *line, size_t len);
+
+#endif
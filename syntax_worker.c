@@ -0,0 +1,127 @@
+#include "syntax_worker.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define SW_PUBLISH_EVERY 4096 // lines between two notifications
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work; // a job was submitted
+    pthread_cond_t idle; // the thread let go of its job
+    sw_job *job;
+    sw_job *running; // the job whose snapshot the thread is reading
+    int started;
+    int notify[2]; // a byte is written whenever states are published
+} sw = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+        PTHREAD_COND_INITIALIZER, NULL, NULL, 0, {-1, -1}};
+
+static void sw_publish(sw_job *job, unsigned done) {
+    pthread_mutex_lock(&sw.lock);
+    job->done = done;
+    pthread_mutex_unlock(&sw.lock);
+    char c = 0;
+    if (write(sw.notify[1], &c, 1) == -1) {
+        // the pipe is full, so the UI is already going to wake up
+    }
+}
+// sw_free() sets the flag without waiting for the thread to take the lock
+static int sw_cancelled(sw_job *job) {
+    return __atomic_load_n(&job->cancelled, __ATOMIC_RELAXED);
+}
+static void *sw_worker(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&sw.lock);
+    while (1) {
+        sw_job *job = sw.job;
+        if (!job) {
+            pthread_cond_wait(&sw.work, &sw.lock);
+            continue;
+        }
+        sw.running = job;
+        pthread_mutex_unlock(&sw.lock);
+
+        int state = job->state;
+        unsigned i = 0;
+        while (i < job->n && !sw_cancelled(job)) {
+            struct sw_line *l = &job->lines[i];
+            state = job->step(job->ctx, l->s, l->len, state);
+            job->states[i++] = state;
+            if (i % SW_PUBLISH_EVERY == 0)
+                sw_publish(job, i);
+        }
+        if (!sw_cancelled(job))
+            sw_publish(job, i);
+
+        pthread_mutex_lock(&sw.lock);
+        sw.running = NULL;
+        if (sw.job == job)
+            sw.job = NULL;
+        pthread_cond_broadcast(&sw.idle);
+    }
+    return NULL;
+}
+static void sw_start() {
+    if (sw.started)
+        return;
+    if (pipe(sw.notify) == -1)
+        abort();
+    fcntl(sw.notify[0], F_SETFL, O_NONBLOCK);
+    fcntl(sw.notify[1], F_SETFL, O_NONBLOCK);
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, sw_worker, NULL) != 0)
+        abort();
+    pthread_detach(tid);
+    sw.started = 1;
+}
+// takes ownership of lines and text
+sw_job *sw_submit(struct sw_line *lines, char *text, unsigned first,
+                  unsigned n, int state, sw_step_fn step, const void *ctx) {
+    sw_start();
+    sw_job *job = calloc(1, sizeof(sw_job));
+    if (!job)
+        abort();
+    job->lines = lines;
+    job->text = text;
+    job->first = first;
+    job->n = n;
+    job->state = state;
+    job->states = malloc(n ? n : 1);
+    job->step = step;
+    job->ctx = ctx;
+    if (!job->states)
+        abort();
+    pthread_mutex_lock(&sw.lock);
+    sw.job = job;
+    pthread_cond_broadcast(&sw.work);
+    pthread_mutex_unlock(&sw.lock);
+    return job;
+}
+// states[0, sw_done()) are final
+unsigned sw_done(sw_job *job) {
+    pthread_mutex_lock(&sw.lock);
+    unsigned done = job->done;
+    pthread_mutex_unlock(&sw.lock);
+    return done;
+}
+// cancels the job and waits until the thread no longer reads its snapshot
+void sw_free(sw_job *job) {
+    pthread_mutex_lock(&sw.lock);
+    __atomic_store_n(&job->cancelled, 1, __ATOMIC_RELAXED);
+    while (sw.running == job)
+        pthread_cond_wait(&sw.idle, &sw.lock);
+    if (sw.job == job)
+        sw.job = NULL;
+    pthread_mutex_unlock(&sw.lock);
+    free(job->lines);
+    free(job->text);
+    free(job->states);
+    free(job);
+}
+int sw_notify_fd() { return sw.notify[0]; }
+void sw_drain_notify() {
+    char buf[64];
+    while (sw.notify[0] != -1 && read(sw.notify[0], buf, sizeof(buf)) > 0)
+        ;
+}
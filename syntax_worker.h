@@ -0,0 +1,38 @@
+#ifndef SYNTAX_WORKER_H
+#define SYNTAX_WORKER_H
+
+/*
+ Background thread that carries highlighter states forward over rows the
+ screen does not show. A job is a snapshot of row text that stays valid
+ until the job is freed: the thread runs `step` over the lines in order,
+ starting from `state`, and publishes every line's exit state as it goes.
+ Only one job runs at a time; whether the results still apply to the rows
+ is for the caller to check when it takes them.
+*/
+struct sw_line {
+    const char *s;
+    int len;
+    unsigned version; // the caller's, to tell whether the row changed since
+};
+typedef int (*sw_step_fn)(const void *ctx, const char *s, int len,
+                          int state);
+typedef struct sw_job {
+    struct sw_line *lines;
+    char *text; // copies of the lines that could change under the thread
+    unsigned first, n; // the snapshot is of rows [first, first + n)
+    int state;         // state before row `first`
+    unsigned char *states;
+    sw_step_fn step;
+    const void *ctx;
+    unsigned done; // lines whose state is published, read with sw_done()
+    int cancelled; // read and written with __atomic builtins
+} sw_job;
+
+sw_job *sw_submit(struct sw_line *lines, char *text, unsigned first,
+                  unsigned n, int state, sw_step_fn step, const void *ctx);
+unsigned sw_done(sw_job *job);
+void sw_free(sw_job *job);
+int sw_notify_fd();
+void sw_drain_notify();
+
+#endif
@@ -0,0 +1,306 @@
+#include "text_store.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TS_LEAF_MAX 64
+#define TS_FANOUT 32
+
+struct ts_node {
+    int leaf;
+    unsigned refs;  // parents and stores pointing here, shared when > 1
+    unsigned n;     // rows in a leaf, children in an inner node
+    unsigned count; // rows in the whole subtree
+};
+struct ts_leaf {
+    struct ts_node h;
+    erow rows[TS_LEAF_MAX];
+};
+struct ts_inner {
+    struct ts_node h;
+    struct ts_node *child[TS_FANOUT];
+};
+#define LEAF(n) ((struct ts_leaf *)(n))
+#define INNER(n) ((struct ts_inner *)(n))
+
+static struct ts_node *ts_new_node(int leaf) {
+    struct ts_node *n =
+        calloc(1, leaf ? sizeof(struct ts_leaf) : sizeof(struct ts_inner));
+    if (!n)
+        abort();
+    n->leaf = leaf;
+    n->refs = 1;
+    return n;
+}
+/*
+ Returns *slot, first replacing it with a private copy if a snapshot shares
+ it. Called top-down, so once the parent is private refs == 1 means no one
+ else can reach the node.
+*/
+static struct ts_node *ts_own(text_store *ts, struct ts_node **slot) {
+    struct ts_node *node = *slot;
+    if (node->refs == 1)
+        return node;
+    size_t size = node->leaf ? sizeof(struct ts_leaf) : sizeof(struct ts_inner);
+    struct ts_node *copy = malloc(size);
+    if (!copy)
+        abort();
+    memcpy(copy, node, size);
+    copy->refs = 1;
+    node->refs--;
+    for (unsigned i = 0; i < copy->n; i++) {
+        if (!copy->leaf)
+            INNER(copy)->child[i]->refs++;
+        else if (ts->share_row)
+            ts->share_row(&LEAF(copy)->rows[i]);
+    }
+    *slot = copy;
+    return copy;
+}
+static unsigned ts_max(struct ts_node *n) {
+    return n->leaf ? TS_LEAF_MAX : TS_FANOUT;
+}
+static void ts_put_child(struct ts_inner *in, unsigned i, struct ts_node *c) {
+    memmove(&in->child[i + 1], &in->child[i],
+            sizeof(struct ts_node *) * (in->h.n - i));
+    in->child[i] = c;
+    in->h.n++;
+}
+static void ts_drop_child(struct ts_inner *in, unsigned i) {
+    memmove(&in->child[i], &in->child[i + 1],
+            sizeof(struct ts_node *) * (in->h.n - i - 1));
+    in->h.n--;
+}
+// moves the upper half of a full node into a new right sibling
+static struct ts_node *ts_split(struct ts_node *node) {
+    unsigned half = node->n / 2;
+    struct ts_node *sib = ts_new_node(node->leaf);
+    sib->n = node->n - half;
+    if (node->leaf) {
+        memcpy(LEAF(sib)->rows, &LEAF(node)->rows[half],
+               sizeof(erow) * sib->n);
+        sib->count = sib->n;
+    } else {
+        memcpy(INNER(sib)->child, &INNER(node)->child[half],
+               sizeof(struct ts_node *) * sib->n);
+        for (unsigned i = 0; i < sib->n; i++)
+            sib->count += INNER(sib)->child[i]->count;
+    }
+    node->n = half;
+    node->count -= sib->count;
+    return sib;
+}
+// folds child i of an inner node into a neighbour if both fit in one node
+static void ts_merge(text_store *ts, struct ts_inner *in, unsigned i) {
+    if (in->h.n < 2)
+        return;
+    unsigned a = (i + 1 < in->h.n) ? i : i - 1;
+    if (in->child[a]->n + in->child[a + 1]->n > ts_max(in->child[a]))
+        return;
+    struct ts_node *l = ts_own(ts, &in->child[a]);
+    struct ts_node *r = ts_own(ts, &in->child[a + 1]);
+    if (l->leaf)
+        memcpy(&LEAF(l)->rows[l->n], LEAF(r)->rows, sizeof(erow) * r->n);
+    else
+        memcpy(&INNER(l)->child[l->n], INNER(r)->child,
+               sizeof(struct ts_node *) * r->n);
+    l->n += r->n;
+    l->count += r->count;
+    free(r);
+    ts_drop_child(in, a + 1);
+}
+static void ts_remove(text_store *ts, struct ts_node *node, unsigned at) {
+    node->count--;
+    if (node->leaf) {
+        erow *rows = LEAF(node)->rows;
+        memmove(&rows[at], &rows[at + 1], sizeof(erow) * (node->n - at - 1));
+        node->n--;
+        return;
+    }
+    struct ts_inner *in = INNER(node);
+    unsigned i = 0;
+    while (at >= in->child[i]->count)
+        at -= in->child[i++]->count;
+    struct ts_node *c = ts_own(ts, &in->child[i]);
+    ts_remove(ts, c, at);
+    if (c->n == 0) {
+        free(c);
+        ts_drop_child(in, i);
+    } else if (c->n < ts_max(c) / 4) {
+        ts_merge(ts, in, i);
+    }
+}
+// drops a reference; the node and its rows go with the last one
+static void ts_free_node(struct ts_node *node, void (*free_row)(erow *)) {
+    if (--node->refs > 0)
+        return;
+    for (unsigned i = 0; i < node->n; i++) {
+        if (!node->leaf)
+            ts_free_node(INNER(node)->child[i], free_row);
+        else if (free_row)
+            free_row(&LEAF(node)->rows[i]);
+    }
+    free(node);
+}
+
+void ts_init(text_store *ts) {
+    ts->root = NULL;
+    ts->finger = NULL;
+    ts->finger_start = 0;
+    ts->share_row = NULL;
+}
+void ts_free(text_store *ts, void (*free_row)(erow *)) {
+    void (*share_row)(erow *) = ts->share_row;
+    if (ts->root)
+        ts_free_node(ts->root, free_row);
+    ts_init(ts);
+    ts->share_row = share_row;
+}
+unsigned ts_nrows(text_store *ts) { return ts->root ? ts->root->count : 0; }
+erow *ts_row(text_store *ts, unsigned at) {
+    struct ts_node *node = ts->root;
+    if (!node || at >= node->count)
+        return NULL;
+    if (ts->finger && at >= ts->finger_start &&
+        at < ts->finger_start + ts->finger->n)
+        return &LEAF(ts->finger)->rows[at - ts->finger_start];
+    unsigned start = at;
+    node = ts_own(ts, &ts->root);
+    while (!node->leaf) {
+        struct ts_inner *in = INNER(node);
+        unsigned i = 0;
+        while (at >= in->child[i]->count)
+            at -= in->child[i++]->count;
+        node = ts_own(ts, &in->child[i]);
+    }
+    ts->finger = node;
+    ts->finger_start = start - at;
+    return &LEAF(node)->rows[at];
+}
+static int ts_walk(struct ts_node *node, unsigned from, unsigned to,
+                   unsigned base, ts_visit_fn visit, void *arg) {
+    if (node->leaf) {
+        for (unsigned i = from; i < to && i < node->n; i++)
+            if (visit(&LEAF(node)->rows[i], base + i, arg))
+                return 1;
+        return 0;
+    }
+    for (unsigned i = 0; i < node->n && from < to; i++) {
+        struct ts_node *c = INNER(node)->child[i];
+        if (from < c->count &&
+            ts_walk(c, from, to, base, visit, arg))
+            return 1;
+        from = from > c->count ? from - c->count : 0;
+        to -= to > c->count ? c->count : to;
+        base += c->count;
+    }
+    return 0;
+}
+/*
+ Calls visit on rows [from, to) in order until it returns nonzero. It does
+ not touch the finger, so several threads may walk the store at once as long
+ as nobody changes it meanwhile. A snapshot never changes, and can be walked
+ while the store it was taken from is edited.
+*/
+void ts_for_range(text_store *ts, unsigned from, unsigned to,
+                  ts_visit_fn visit, void *arg) {
+    if (ts->root && from < to)
+        ts_walk(ts->root, from, to, 0, visit, arg);
+}
+// returns a zeroed row slot at index `at`, splitting full nodes top-down
+erow *ts_insert(text_store *ts, unsigned at) {
+    if (!ts->root)
+        ts->root = ts_new_node(1);
+    if (at > ts->root->count)
+        return NULL;
+    ts->finger = NULL;
+    ts_own(ts, &ts->root);
+    if (ts->root->n == ts_max(ts->root)) {
+        struct ts_node *root = ts_new_node(0);
+        INNER(root)->child[0] = ts->root;
+        root->n = 1;
+        root->count = ts->root->count;
+        ts->root = root;
+    }
+    struct ts_node *node = ts->root;
+    while (!node->leaf) {
+        struct ts_inner *in = INNER(node);
+        unsigned i = 0;
+        while (i + 1 < in->h.n && at > in->child[i]->count)
+            at -= in->child[i++]->count;
+        ts_own(ts, &in->child[i]);
+        if (in->child[i]->n == ts_max(in->child[i])) {
+            ts_put_child(in, i + 1, ts_split(in->child[i]));
+            if (at > in->child[i]->count)
+                at -= in->child[i++]->count;
+        }
+        in->h.count++;
+        node = in->child[i];
+    }
+    erow *rows = LEAF(node)->rows;
+    memmove(&rows[at + 1], &rows[at], sizeof(erow) * (node->n - at));
+    memset(&rows[at], 0, sizeof(erow));
+    node->n++;
+    node->count++;
+    return &rows[at];
+}
+/*
+ Bulk-loads n rows into an empty store: leaves are packed full and the inner
+ levels are built bottom-up, which is O(n) instead of n top-down inserts.
+*/
+void ts_build(text_store *ts, unsigned n,
+              void (*fill)(erow *row, unsigned at, void *arg), void *arg) {
+    if (ts->root || n == 0)
+        return;
+    unsigned width = (n + TS_LEAF_MAX - 1) / TS_LEAF_MAX;
+    struct ts_node **level = malloc(sizeof(struct ts_node *) * width);
+    if (!level)
+        abort();
+    for (unsigned i = 0, at = 0; i < width; i++) {
+        struct ts_node *leaf = ts_new_node(1);
+        while (leaf->n < TS_LEAF_MAX && at < n)
+            fill(&LEAF(leaf)->rows[leaf->n++], at++, arg);
+        leaf->count = leaf->n;
+        level[i] = leaf;
+    }
+    while (width > 1) {
+        unsigned up = (width + TS_FANOUT - 1) / TS_FANOUT;
+        for (unsigned i = 0; i < up; i++) {
+            struct ts_node *in = ts_new_node(0);
+            for (unsigned j = i * TS_FANOUT; j < width && in->n < TS_FANOUT;
+                 j++) {
+                INNER(in)->child[in->n++] = level[j];
+                in->count += level[j]->count;
+            }
+            level[i] = in;
+        }
+        width = up;
+    }
+    ts->root = level[0];
+    ts->finger = NULL;
+    free(level);
+}
+// unlinks row `at`; its contents must already be released by the caller
+void ts_delete(text_store *ts, unsigned at) {
+    if (!ts->root || at >= ts->root->count)
+        return;
+    ts->finger = NULL;
+    ts_remove(ts, ts_own(ts, &ts->root), at);
+    while (!ts->root->leaf && ts->root->n <= 1) {
+        struct ts_node *old = ts->root;
+        if (old->n == 0) {
+            free(old);
+            ts->root = NULL;
+            return;
+        }
+        ts->root = INNER(old)->child[0];
+        free(old);
+    }
+}
+// makes snap a frozen copy of ts, to be released with ts_free(snap, NULL)
+void ts_snapshot(text_store *ts, text_store *snap) {
+    ts_init(snap);
+    snap->root = ts->root;
+    if (ts->root)
+        ts->root->refs++;
+    ts->finger = NULL;
+}
@@ -0,0 +1,64 @@
+#ifndef TEXT_STORE_H
+#define TEXT_STORE_H
+
+// a tab at column cx of chars, and the render column right after it
+struct row_tab {
+    int cx, rx;
+};
+// chars [start, start + len) are highlighted as hl; the gaps are HL_NORMAL
+struct hl_span {
+    unsigned start;
+    unsigned len : 24;
+    unsigned hl : 8;
+};
+typedef struct erow {
+    int size;
+    int cap; // bytes chars has room for, 0 unless it came from the arena,
+             // negated while a save snapshot shares them
+    unsigned syntax_gen; // config.syntax_gen the hl was built for
+    unsigned version;    // changes whenever chars do, unique across rows
+    unsigned char borrowed; // chars points into a shared slab, not freed
+    unsigned char dirty;    // spans are stale and rebuilt on next draw
+    unsigned char hl_in;  // highlighter state spans were built from
+    unsigned char hl_out; // highlighter state at the end of the line
+    char *chars;
+    struct hl_span *spans; // in order, NULL when the row is all HL_NORMAL
+    struct row_tab *tabs;  // built on demand, see editor_index_tabs()
+    int nspans;
+    int ntabs; // -1 until built
+} erow;
+
+/*
+ Rows live in the leaves of a counted B+tree, so looking up, inserting or
+ deleting a line costs O(log n) no matter where it happens. Pointers returned
+ by ts_row()/ts_insert() stay valid until the next insert or delete.
+
+ ts_snapshot() freezes the store in O(1) by sharing its root: nodes are
+ reference counted, and whatever ts_row(), ts_insert() or ts_delete() would
+ change in a shared node is changed in a copy, along with the path above it.
+ Rows in a copied leaf still point at the same chars, so the store calls
+ share_row on each of them; anything the row owns must be copied before it
+ is written from then on.
+*/
+struct ts_node;
+typedef struct text_store {
+    struct ts_node *root;
+    struct ts_node *finger; // leaf of the last lookup, makes sequential
+    unsigned finger_start;  // access O(1)
+    void (*share_row)(erow *row);
+} text_store;
+
+void ts_init(text_store *ts);
+void ts_free(text_store *ts, void (*free_row)(erow *));
+unsigned ts_nrows(text_store *ts);
+erow *ts_row(text_store *ts, unsigned at);
+erow *ts_insert(text_store *ts, unsigned at);
+void ts_build(text_store *ts, unsigned n,
+              void (*fill)(erow *row, unsigned at, void *arg), void *arg);
+void ts_delete(text_store *ts, unsigned at);
+void ts_snapshot(text_store *ts, text_store *snap);
+typedef int (*ts_visit_fn)(erow *row, unsigned at, void *arg);
+void ts_for_range(text_store *ts, unsigned from, unsigned to,
+                  ts_visit_fn visit, void *arg);
+
+#endif
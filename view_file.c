@@ -0,0 +1,220 @@
+#include "view_file.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define VF_BUCKETS (VF_CACHE_ROWS * 2)
+#define VF_SCAN_WINDOW (64 << 20)
+
+static size_t vf_row_bytes(erow *row) {
+    return sizeof(struct vf_slot) + row->size + 1 +
+           sizeof(struct hl_span) * row->nspans +
+           sizeof(struct row_tab) * (row->ntabs > 0 ? row->ntabs : 0);
+}
+// drops mapped pages from our resident set once enough of them were read
+void vf_account(view_file *vf, size_t n) {
+    vf->touched += n;
+    if (vf->touched < VF_MAP_RESIDENT)
+        return;
+    madvise((void *)vf->map, vf->len, MADV_DONTNEED);
+    vf->touched = 0;
+}
+static void vf_unlink(view_file *vf, int s) {
+    struct vf_slot *slot = &vf->slots[s];
+    if (slot->prev != -1)
+        vf->slots[slot->prev].next = slot->next;
+    else
+        vf->head = slot->next;
+    if (slot->next != -1)
+        vf->slots[slot->next].prev = slot->prev;
+    else
+        vf->tail = slot->prev;
+}
+static void vf_link_head(view_file *vf, int s) {
+    vf->slots[s].prev = -1;
+    vf->slots[s].next = vf->head;
+    if (vf->head != -1)
+        vf->slots[vf->head].prev = s;
+    vf->head = s;
+    if (vf->tail == -1)
+        vf->tail = s;
+}
+static void vf_evict(view_file *vf, int s) {
+    struct vf_slot *slot = &vf->slots[s];
+    int *p = &vf->buckets[slot->at % VF_BUCKETS];
+    while (*p != s)
+        p = &vf->slots[*p].hnext;
+    *p = slot->hnext;
+    vf_unlink(vf, s);
+    vf->bytes -= slot->bytes;
+    vf->release(&slot->row);
+    slot->hnext = vf->free;
+    vf->free = s;
+}
+static int vf_alloc_slot(view_file *vf) {
+    if (vf->free == -1 && vf->nslots < VF_CACHE_ROWS) {
+        vf->slots[vf->nslots].hnext = vf->free;
+        vf->free = vf->nslots++;
+    }
+    if (vf->free == -1)
+        vf_evict(vf, vf->tail);
+    int s = vf->free;
+    vf->free = vf->slots[s].hnext;
+    return s;
+}
+// offset of line k * VF_CHECKPOINT_EVERY; safe to call from any thread
+size_t vf_checkpoint(view_file *vf, unsigned k) {
+    if (k == 0)
+        return 0;
+    if (k > vf->lines.noffsets)
+        return vf->len;
+    return vf->lines.offsets[k - 1] + 1;
+}
+// drops the pages of a range that was scanned once; safe from any thread
+void vf_drop_range(view_file *vf, size_t off, size_t len) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t start = off / page * page;
+    madvise((void *)(vf->map + start), off + len - start, MADV_DONTNEED);
+}
+// offset of the first byte of line `at`, walking from the nearest checkpoint
+size_t vf_line_offset(view_file *vf, unsigned at) {
+    unsigned from = at / VF_CHECKPOINT_EVERY * VF_CHECKPOINT_EVERY;
+    size_t off = vf_checkpoint(vf, from / VF_CHECKPOINT_EVERY);
+    if (vf->last_at <= at && vf->last_at > from) {
+        from = vf->last_at;
+        off = vf->last_off;
+    }
+    size_t begin = off;
+    for (; from < at; from++)
+        off = (const char *)memchr(vf->map + off, '\n', vf->len - off) -
+              vf->map + 1;
+    vf_account(vf, off - begin);
+    vf->last_at = at;
+    vf->last_off = off;
+    return off;
+}
+
+int vf_open(view_file *vf, const char *filename, void (*build)(erow *),
+            void (*release)(erow *)) {
+    memset(vf, 0, sizeof(*vf));
+    vf->build = build;
+    vf->release = release;
+    vf->head = vf->tail = vf->free = -1;
+    memscan_init(&vf->lines, VF_CHECKPOINT_EVERY);
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return -1;
+    }
+    vf->len = st.st_size;
+    if (vf->len) {
+        void *map = mmap(NULL, vf->len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        vf->map = map;
+    }
+    close(fd);
+    vf->slots = malloc(sizeof(struct vf_slot) * VF_CACHE_ROWS);
+    vf->buckets = malloc(sizeof(int) * VF_BUCKETS);
+    if (!vf->slots || !vf->buckets)
+        return -1;
+    for (int i = 0; i < VF_BUCKETS; i++)
+        vf->buckets[i] = -1;
+
+    madvise((void *)vf->map, vf->len, MADV_SEQUENTIAL);
+    for (size_t off = 0; off < vf->len; off += VF_SCAN_WINDOW) {
+        size_t n = vf->len - off;
+        if (n > VF_SCAN_WINDOW)
+            n = VF_SCAN_WINDOW;
+        memscan_newlines(&vf->lines, vf->map + off, n, off);
+        madvise((void *)(vf->map + off), n, MADV_DONTNEED);
+    }
+    madvise((void *)vf->map, vf->len, MADV_RANDOM);
+    vf->nrows = vf->lines.count;
+    if (vf->len && vf->map[vf->len - 1] != '\n')
+        vf->nrows++;
+    return 0;
+}
+void vf_close(view_file *vf) {
+    while (vf->head != -1)
+        vf_evict(vf, vf->head);
+    if (vf->map)
+        munmap((void *)vf->map, vf->len);
+    free(vf->slots);
+    free(vf->buckets);
+    memscan_free(&vf->lines);
+    memset(vf, 0, sizeof(*vf));
+}
+static int vf_find(view_file *vf, unsigned at) {
+    int s = vf->buckets[at % VF_BUCKETS];
+    while (s != -1 && vf->slots[s].at != at)
+        s = vf->slots[s].hnext;
+    return s;
+}
+// the row if it is materialized, without loading it or touching the LRU
+erow *vf_cached(view_file *vf, unsigned at) {
+    if (at >= vf->nrows)
+        return NULL;
+    int s = vf_find(vf, at);
+    return s != -1 ? &vf->slots[s].row : NULL;
+}
+/*
+ Counts a row again after it grew past what it was built with, as spans and
+ tab indexes are only made when the row is drawn or walked. Older rows are
+ evicted to make room, never the row itself, which the caller is using.
+*/
+void vf_recount(view_file *vf, erow *row) {
+    struct vf_slot *slot = (struct vf_slot *)row;
+    size_t bytes = vf_row_bytes(row);
+    vf->bytes = vf->bytes - slot->bytes + bytes;
+    slot->bytes = bytes;
+    int s = slot - vf->slots;
+    while (vf->bytes > VF_CACHE_BYTES && vf->tail != s)
+        vf_evict(vf, vf->tail);
+}
+erow *vf_row(view_file *vf, unsigned at) {
+    if (at >= vf->nrows)
+        return NULL;
+    int s = vf_find(vf, at);
+    if (s != -1) {
+        vf_unlink(vf, s);
+        vf_link_head(vf, s);
+        return &vf->slots[s].row;
+    }
+
+    size_t start = vf_line_offset(vf, at);
+    const char *nl = memchr(vf->map + start, '\n', vf->len - start);
+    size_t end = nl ? (size_t)(nl - vf->map) : vf->len;
+    vf_account(vf, end - start);
+    while (end > start && vf->map[end - 1] == '\r')
+        end--;
+
+    s = vf_alloc_slot(vf);
+    struct vf_slot *slot = &vf->slots[s];
+    memset(&slot->row, 0, sizeof(erow));
+    slot->at = at;
+    slot->row.size = end - start;
+    slot->row.chars = malloc(slot->row.size + 1);
+    if (!slot->row.chars)
+        abort();
+    memcpy(slot->row.chars, vf->map + start, slot->row.size);
+    slot->row.chars[slot->row.size] = '\0';
+    vf->build(&slot->row);
+    slot->bytes = vf_row_bytes(&slot->row);
+    vf->bytes += slot->bytes;
+
+    slot->hnext = vf->buckets[at % VF_BUCKETS];
+    vf->buckets[at % VF_BUCKETS] = s;
+    vf_link_head(vf, s);
+    while (vf->bytes > VF_CACHE_BYTES && vf->tail != s)
+        vf_evict(vf, vf->tail);
+    return &slot->row;
+}
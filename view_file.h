@@ -0,0 +1,51 @@
+#ifndef VIEW_FILE_H
+#define VIEW_FILE_H
+#include "memscan.h"
+#include "text_store.h"
+#include <stddef.h>
+
+#define VF_CHECKPOINT_EVERY 1024 // lines between two indexed offsets
+#define VF_CACHE_ROWS 4096       // materialized rows kept at most
+#define VF_CACHE_BYTES (64 << 20) // memory cap for materialized rows
+#define VF_MAP_RESIDENT (64 << 20) // mapped bytes touched before dropping
+
+struct vf_slot {
+    erow row; // first, so a row handed out leads back to its slot
+    unsigned at;
+    size_t bytes;   // accounted against VF_CACHE_BYTES
+    int prev, next; // LRU list, most recently used first
+    int hnext;      // hash chain, or free list when unused
+};
+/*
+ Read-only view of a mmapped file. Only every VF_CHECKPOINT_EVERY-th line
+ offset is indexed; rows are materialized on demand into a small LRU cache
+ whose size is bounded both in rows and in bytes.
+*/
+typedef struct view_file {
+    const char *map;
+    size_t len;
+    unsigned nrows;
+    struct memscan_index lines;
+    unsigned last_at; // start of the last located line, for sequential
+    size_t last_off;  // lookups
+    size_t touched;   // mapped bytes read since pages were last dropped
+    struct vf_slot *slots;
+    int *buckets;
+    int nslots, head, tail, free;
+    size_t bytes;
+    void (*build)(erow *);
+    void (*release)(erow *);
+} view_file;
+
+int vf_open(view_file *vf, const char *filename, void (*build)(erow *),
+            void (*release)(erow *));
+void vf_close(view_file *vf);
+erow *vf_row(view_file *vf, unsigned at);
+erow *vf_cached(view_file *vf, unsigned at);
+void vf_recount(view_file *vf, erow *row);
+size_t vf_line_offset(view_file *vf, unsigned at);
+void vf_account(view_file *vf, size_t n);
+size_t vf_checkpoint(view_file *vf, unsigned k);
+void vf_drop_range(view_file *vf, size_t off, size_t len);
+
+#endif